@@ -24,6 +24,10 @@
 #include "view.h"
 #include "viewrender.h"
 
+#ifdef PORTAL
+#include "PortalRender.h"
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -1503,6 +1507,21 @@ static RenderGroup_t DetectBucketedRenderGroup( RenderGroup_t group, float fDime
 	return bucketedGroup;
 }
 
+#ifdef PORTAL
+//-----------------------------------------------------------------------------
+// Detail props only have model space bounds, so test a box that covers them at any orientation
+//-----------------------------------------------------------------------------
+static bool CullDetailPropAgainstPortalView( IClientRenderable *pRenderable )
+{
+	Vector vMins, vMaxs;
+	pRenderable->GetRenderBounds( vMins, vMaxs );
+	float flRadius = MAX( vMins.Length(), vMaxs.Length() );
+	Vector vRadius( flRadius, flRadius, flRadius );
+	const Vector &vOrigin = pRenderable->GetRenderOrigin();
+	return g_pPortalRender->CullBoxAgainstPortalView( vOrigin - vRadius, vOrigin + vRadius );
+}
+#endif
+
 void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex,	const SetupRenderInfo_t &info )
 {
 	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
@@ -1580,6 +1599,12 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 				continue;
 		}
 
+#ifdef PORTAL
+		// Views through portals can only see what's behind the clipped portal polygon
+		if ( info.m_bCullAgainstPortalView && g_pPortalRender->CullBoxAgainstPortalView( absMins, absMaxs ) )
+			continue;
+#endif
+
 		// UNDONE: Investigate speed tradeoffs of occlusion culling brush models too?
 		if ( renderable.m_Flags & RENDER_FLAGS_STUDIO_MODEL )
 		{
@@ -1658,6 +1683,13 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 			IClientRenderable* pRenderable = DetailObjectSystem()->GetDetailModel(idx);
 
 			// FIXME: This if check here is necessary because the detail object system also maintains lists of sprites...
+#ifdef PORTAL
+			// Views through portals can only see what's behind the clipped portal polygon
+			if ( pRenderable && info.m_bCullAgainstPortalView && CullDetailPropAgainstPortalView( pRenderable ) )
+			{
+				pRenderable = NULL;
+			}
+#endif
 			if (pRenderable)
 			{
 				if( pRenderable->IsTransparent() )
@@ -83,11 +83,13 @@ struct SetupRenderInfo_t
 	float m_flRenderDistSq;
 	bool m_bDrawDetailObjects : 1;
 	bool m_bDrawTranslucentObjects : 1;
+	bool m_bCullAgainstPortalView : 1;	// Only set for a portal's own view, not the skybox/water/shadow views rendered inside it
 
 	SetupRenderInfo_t()
 	{
 		m_bDrawDetailObjects = true;
 		m_bDrawTranslucentObjects = true;
+		m_bCullAgainstPortalView = false;
 	}
 };
 
@@ -11,14 +11,22 @@
 #include "c_portal_player.h"
 #include "model_types.h"
 
+static ConVar cl_portal_ghost_bone_cache( "cl_portal_ghost_bone_cache", "1", FCVAR_CHEAT, "Transform a ghost's bones once per frame instead of once per view it's drawn in." );
+
 C_PortalGhostRenderable::C_PortalGhostRenderable( C_Prop_Portal *pOwningPortal, C_BaseEntity *pGhostSource, RenderGroup_t sourceRenderGroup, const VMatrix &matGhostTransform, float *pSharedRenderClipPlane, bool bLocalPlayer )
 : m_pGhostedRenderable( pGhostSource ), 
+	m_hGhostSource( pGhostSource ),
+	m_SourceRenderGroup( sourceRenderGroup ),
+	m_iLastGhostedFrame( gpGlobals->framecount ),
+	m_bInLeafSystem( true ),
 	m_matGhostTransform( matGhostTransform ), 
 	m_pSharedRenderClipPlane( pSharedRenderClipPlane ),
 	m_bLocalPlayer( bLocalPlayer ),
 	m_pOwningPortal( pOwningPortal )
 {
 	m_bSourceIsBaseAnimating = (dynamic_cast<C_BaseAnimating *>(pGhostSource) != NULL);
+	m_TransformedBones.iFrame = -1;
+	m_TransformedBones.iBoneMask = 0;
 
 	cl_entitylist->AddNonNetworkableEntity( GetIClientUnknown() );
 	g_pClientLeafSystem->AddRenderable( this, sourceRenderGroup );
@@ -27,7 +35,8 @@ C_PortalGhostRenderable::C_PortalGhostRenderable( C_Prop_Portal *pOwningPortal,
 C_PortalGhostRenderable::~C_PortalGhostRenderable( void )
 {
 	m_pGhostedRenderable = NULL;
-	g_pClientLeafSystem->RemoveRenderable( RenderHandle() );
+	if( m_bInLeafSystem )
+		g_pClientLeafSystem->RemoveRenderable( RenderHandle() );
 	cl_entitylist->RemoveEntity( GetIClientUnknown()->GetRefEHandle() );
 
 	DestroyModelInstance();
@@ -64,7 +73,37 @@ void C_PortalGhostRenderable::PerFrameUpdate( void )
 
 	RemoveFromInterpolationList();
 
-	g_pClientLeafSystem->RenderableChanged( RenderHandle() );
+	if( m_bInLeafSystem )
+		g_pClientLeafSystem->RenderableChanged( RenderHandle() );
+}
+
+void C_PortalGhostRenderable::SetInLeafSystem( bool bInLeafSystem )
+{
+	if( m_bInLeafSystem == bInLeafSystem )
+		return;
+
+	m_bInLeafSystem = bInLeafSystem;
+	if( bInLeafSystem )
+		g_pClientLeafSystem->AddRenderable( this, m_SourceRenderGroup );
+	else
+		g_pClientLeafSystem->RemoveRenderable( RenderHandle() );
+}
+
+bool C_PortalGhostRenderable::IsEntirelyClipped( void )
+{
+	if( (m_pGhostedRenderable == NULL) || (m_pSharedRenderClipPlane == NULL) )
+		return false;
+
+	Vector vMins, vMaxs;
+	GetRenderBoundsWorldspace( vMins, vMaxs );
+
+	//the corner furthest along the plane normal is the last one to be clipped
+	const Vector &vNormal = *(const Vector *)m_pSharedRenderClipPlane;
+	Vector ptFurthest( (vNormal.x > 0.0f) ? vMaxs.x : vMins.x,
+						(vNormal.y > 0.0f) ? vMaxs.y : vMins.y,
+						(vNormal.z > 0.0f) ? vMaxs.z : vMins.z );
+
+	return (vNormal.Dot( ptFurthest ) < m_pSharedRenderClipPlane[3]);
 }
 
 Vector const& C_PortalGhostRenderable::GetRenderOrigin( void )
@@ -90,19 +129,45 @@ bool C_PortalGhostRenderable::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMax
 	if( m_pGhostedRenderable == NULL )
 		return false;
 
-	if( m_pGhostedRenderable->SetupBones( pBoneToWorldOut, nMaxBones, boneMask, currentTime ) )
+	bool bUseCache = cl_portal_ghost_bone_cache.GetBool() && (pBoneToWorldOut != NULL);
+	if( bUseCache &&
+		(m_TransformedBones.iFrame == gpGlobals->framecount) &&
+		((boneMask & ~m_TransformedBones.iBoneMask) == 0) &&
+		(m_TransformedBones.BoneToWorld.Count() <= nMaxBones) )
 	{
-		if( pBoneToWorldOut )
-		{
-			for( int i = 0; i != nMaxBones; ++i ) //FIXME: nMaxBones is most definitely greater than the actual number of bone transforms actually used, find the subset somehow
-			{
-				pBoneToWorldOut[i] = (m_matGhostTransform * pBoneToWorldOut[i]).As3x4();
-			}
-		}
+		memcpy( pBoneToWorldOut, m_TransformedBones.BoneToWorld.Base(), sizeof( matrix3x4_t ) * m_TransformedBones.BoneToWorld.Count() );
 		return true;
 	}
 
-	return false;
+	//the source caches its own pose for the frame, so this is just a copy unless it hasn't been drawn yet
+	if( !m_pGhostedRenderable->SetupBones( pBoneToWorldOut, nMaxBones, boneMask, currentTime ) )
+		return false;
+
+	if( pBoneToWorldOut == NULL )
+		return true;
+
+	int iBoneCount = nMaxBones;
+	if( m_bSourceIsBaseAnimating )
+	{
+		CStudioHdr *pStudioHdr = ((C_BaseAnimating *)m_pGhostedRenderable)->GetModelPtr();
+		if( pStudioHdr )
+			iBoneCount = MIN( nMaxBones, pStudioHdr->numbones() );
+	}
+
+	for( int i = 0; i != iBoneCount; ++i )
+	{
+		pBoneToWorldOut[i] = (m_matGhostTransform * pBoneToWorldOut[i]).As3x4();
+	}
+
+	if( bUseCache )
+	{
+		m_TransformedBones.BoneToWorld.SetCount( iBoneCount );
+		memcpy( m_TransformedBones.BoneToWorld.Base(), pBoneToWorldOut, sizeof( matrix3x4_t ) * iBoneCount );
+		m_TransformedBones.iFrame = gpGlobals->framecount;
+		m_TransformedBones.iBoneMask = boneMask;
+	}
+
+	return true;
 }
 
 void C_PortalGhostRenderable::GetRenderBounds( Vector& mins, Vector& maxs )
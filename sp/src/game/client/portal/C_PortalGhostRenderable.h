@@ -18,7 +18,11 @@
 class C_PortalGhostRenderable : public C_BaseAnimating//IClientRenderable, public IClientUnknown
 {
 public:
-	C_BaseEntity *m_pGhostedRenderable; //the renderable we're transforming and re-rendering
+	C_BaseEntity *m_pGhostedRenderable; //the renderable we're transforming and re-rendering, NULL while pooled
+	EHANDLE m_hGhostSource; //what the owning portal matches ghosts against, survives pooling so a returning entity gets its old ghost back
+	RenderGroup_t m_SourceRenderGroup;
+	int m_iLastGhostedFrame; //last frame the source was in the portal hole
+	bool m_bInLeafSystem;
 	
 	VMatrix m_matGhostTransform;
 	float *m_pSharedRenderClipPlane; //shared by all portal ghost renderables within the same portal
@@ -33,10 +37,20 @@ public:
 		matrix3x4_t matRenderableToWorldTransform;
 	} m_ReferencedReturns; //when returning a reference, it has to actually exist somewhere
 
+	struct
+	{
+		CUtlVector<matrix3x4_t> BoneToWorld; //source bones already run through m_matGhostTransform
+		int iFrame;
+		int iBoneMask;
+	} m_TransformedBones; //the ghost is drawn in several views per frame, only transform the source's bones once
+
 	C_PortalGhostRenderable( C_Prop_Portal *pOwningPortal, C_BaseEntity *pGhostSource, RenderGroup_t sourceRenderGroup, const VMatrix &matGhostTransform, float *pSharedRenderClipPlane, bool bLocalPlayer );
 	virtual ~C_PortalGhostRenderable( void );
 
 	void PerFrameUpdate( void ); //called once per frame for misc updating
+	void SetInLeafSystem( bool bInLeafSystem ); //hidden ghosts are kept around but aren't considered for rendering
+	bool IsEntirelyClipped( void ); //true if the shared clip plane would clip away the whole ghost
+	void InvalidateBoneCache( void ) { m_TransformedBones.iFrame = -1; }
 
 	// Data accessors
 	virtual Vector const&			GetRenderOrigin( void );
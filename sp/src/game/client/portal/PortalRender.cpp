@@ -19,6 +19,7 @@
 #include "view_scene.h"
 #include "viewrender.h"
 #include "vprof.h"
+#include "tier0/fasttimer.h"
 
 CLIENTEFFECT_REGISTER_BEGIN( PrecachePortalDrawingMaterials )
 CLIENTEFFECT_MATERIAL( "shadertest/wireframe" )
@@ -33,6 +34,26 @@ static ConVar r_forcecheapwater( "r_forcecheapwater", "0", FCVAR_CLIENTDLL | FCV
 
 ConVar r_portal_use_stencils( "r_portal_use_stencils", "1", FCVAR_CLIENTDLL, "Render portal views using stencils (if available)" ); //draw portal views using stencil rendering
 ConVar r_portal_stencil_depth( "r_portal_stencil_depth", "2", FCVAR_CLIENTDLL | FCVAR_ARCHIVE, "When using stencil views, this changes how many views within views we see" );
+static ConVar r_portal_recursion_budget_ms( "r_portal_recursion_budget_ms", "0", FCVAR_CLIENTDLL | FCVAR_ARCHIVE, "Milliseconds per frame that views through portals may take. When a frame goes over, the next frame renders one less level of views within views. 0 disables the budget" );
+static ConVar r_portal_lod_distance_scale( "r_portal_lod_distance_scale", "1.0", FCVAR_CLIENTDLL | FCVAR_ARCHIVE, "Far plane and renderable distance multiplier applied once per portal view recursion level", true, 0.1f, true, 1.0f );
+static ConVar r_portal_cull_with_clipped_frustum( "r_portal_cull_with_clipped_frustum", "1", FCVAR_CLIENTDLL, "Cull renderables and detail props in views through portals against every edge of the on screen portal polygon instead of the 4 plane approximation" );
+static ConVar r_portal_lod_start_depth( "r_portal_lod_start_depth", "0", FCVAR_CLIENTDLL | FCVAR_ARCHIVE, "Portal view recursion level at which detail props and shadow texture updates are skipped, 0 to never skip them" );
+
+//vprof node names for each level of views within views, so deep recursion shows up separately in the profiler
+static const char *s_szPortalViewDepthVProfNames[MAX_PORTAL_RECURSIVE_VIEWS] =
+{
+	"CPortalRender::PortalView_Depth0",
+	"CPortalRender::PortalView_Depth1",
+	"CPortalRender::PortalView_Depth2",
+	"CPortalRender::PortalView_Depth3",
+	"CPortalRender::PortalView_Depth4",
+	"CPortalRender::PortalView_Depth5",
+	"CPortalRender::PortalView_Depth6",
+	"CPortalRender::PortalView_Depth7",
+	"CPortalRender::PortalView_Depth8",
+	"CPortalRender::PortalView_Depth9",
+	"CPortalRender::PortalView_Depth10",
+};
 
 //-----------------------------------------------------------------------------
 //
@@ -213,6 +234,10 @@ CPortalRender::CPortalRender()
 	m_pRenderingViewForPortal = NULL;
 	m_pRenderingViewExitPortal = NULL;
 
+	m_iBudgetedMaxViewDepth = MAX_PORTAL_RECURSIVE_VIEWS;
+	m_iRecursionBudgetFrame = -1;
+	m_fNestedViewTimeThisFrame = 0.0f;
+
 	m_PortalViewIDNodeChain[0] = &m_HeadPortalViewIDNode;
 }
 
@@ -496,7 +521,10 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 	if( iNumRenderablePortals == 0 )
 		return false;
 
-	const int iMaxDepth = min( r_portal_stencil_depth.GetInt(), min( MAX_PORTAL_RECURSIVE_VIEWS, (1 << materials->StencilBufferBits()) ) - 1 );
+	if( m_iViewRecursionLevel == 0 )
+		UpdateRecursionBudget();
+
+	const int iMaxDepth = min( min( r_portal_stencil_depth.GetInt(), m_iBudgetedMaxViewDepth ), min( MAX_PORTAL_RECURSIVE_VIEWS, (1 << materials->StencilBufferBits()) ) - 1 );
 
 	if( m_iViewRecursionLevel >= iMaxDepth ) //can't support any more views	
 	{
@@ -645,7 +673,22 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 
 				m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex];
 				
-				pCurrentPortal->RenderPortalViewToBackBuffer( pViewRender, *pViewSetup );
+				{
+					VPROF( s_szPortalViewDepthVProfNames[m_iViewRecursionLevel + 1] );
+
+					//only time the outermost views, nested views are already included in their parent's time
+					CFastTimer viewTimer;
+					if( m_iViewRecursionLevel == 0 )
+						viewTimer.Start();
+
+					pCurrentPortal->RenderPortalViewToBackBuffer( pViewRender, *pViewSetup );
+
+					if( m_iViewRecursionLevel == 0 )
+					{
+						viewTimer.End();
+						m_fNestedViewTimeThisFrame += viewTimer.GetDuration().GetMillisecondsF();
+					}
+				}
 				
 				m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = NULL;
 
@@ -924,6 +967,95 @@ int	CPortalRender::GetRemainingPortalViewDepth() const
 }
 
 
+//-----------------------------------------------------------------------------
+// Per recursion level detail reduction for views seen through portals
+//-----------------------------------------------------------------------------
+float CPortalRender::GetViewDistanceScale( int iRecursionLevel ) const
+{
+	float fScale = r_portal_lod_distance_scale.GetFloat();
+	if( (iRecursionLevel <= 0) || (fScale >= 1.0f) )
+		return 1.0f;
+
+	return powf( fScale, (float)iRecursionLevel );
+}
+
+bool CPortalRender::ShouldDrawDetailObjects( int iRecursionLevel ) const
+{
+	int iStartDepth = r_portal_lod_start_depth.GetInt();
+	return (iStartDepth <= 0) || (iRecursionLevel == 0) || (iRecursionLevel < iStartDepth);
+}
+
+bool CPortalRender::ShouldUpdateShadowTextures( int iRecursionLevel ) const
+{
+	//shadows still project at deeper levels, they just reuse textures rendered for a shallower view
+	int iStartDepth = r_portal_lod_start_depth.GetInt();
+	return (iStartDepth <= 0) || (iRecursionLevel == 0) || (iRecursionLevel < iStartDepth);
+}
+
+
+//-----------------------------------------------------------------------------
+// The complex frustum for a portal view has a side plane for each edge of the portal quad after it was clipped
+// to the parent view, so it can be far tighter than the 4 side planes the engine culls with.
+// Only valid for the portal's own view. The skybox, water and shadow depth views rendered while
+// a portal view is on the stack have their own cameras, so callers check the view id first
+// (see SetupRenderInfo_t::m_bCullAgainstPortalView).
+//-----------------------------------------------------------------------------
+bool CPortalRender::CullBoxAgainstPortalView( const Vector &vMins, const Vector &vMaxs ) const
+{
+	if( (m_iViewRecursionLevel == 0) || !r_portal_cull_with_clipped_frustum.GetBool() )
+		return false;
+
+	const CUtlVector<VPlane> &complexFrustum = m_RecursiveViewComplexFrustums[m_iViewRecursionLevel];
+	for( int i = complexFrustum.Count(); --i >= 0; )
+	{
+		//planes face into the frustum, so test the box corner farthest along the normal
+		const VPlane &plane = complexFrustum[i];
+		Vector vFarthest( (plane.m_Normal.x >= 0.0f) ? vMaxs.x : vMins.x,
+						  (plane.m_Normal.y >= 0.0f) ? vMaxs.y : vMins.y,
+						  (plane.m_Normal.z >= 0.0f) ? vMaxs.z : vMins.z );
+
+		if( plane.DistTo( vFarthest ) < 0.0f )
+			return true;
+	}
+
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Once per frame, trade view depth against r_portal_recursion_budget_ms using
+// the time last frame's views through portals took
+//-----------------------------------------------------------------------------
+void CPortalRender::UpdateRecursionBudget( void )
+{
+	if( m_iRecursionBudgetFrame == gpGlobals->framecount )
+		return; //already updated, DrawPortalsUsingStencils() can be entered more than once per frame at level 0
+
+	float fBudget = r_portal_recursion_budget_ms.GetFloat();
+	if( fBudget <= 0.0f )
+	{
+		m_iBudgetedMaxViewDepth = MAX_PORTAL_RECURSIVE_VIEWS;
+	}
+	else if( m_iRecursionBudgetFrame == gpGlobals->framecount - 1 ) //only trust timings from the previous frame
+	{
+		if( m_fNestedViewTimeThisFrame > fBudget )
+		{
+			//never budget away the first level, a portal with nothing behind it looks broken rather than cheap
+			int iCurrentDepth = min( m_iBudgetedMaxViewDepth, r_portal_stencil_depth.GetInt() );
+			m_iBudgetedMaxViewDepth = max( iCurrentDepth - 1, 1 );
+		}
+		else if( (m_fNestedViewTimeThisFrame < (fBudget * 0.5f)) && (m_iBudgetedMaxViewDepth < MAX_PORTAL_RECURSIVE_VIEWS) )
+		{
+			//well under budget, let one more level back in. Waiting for half the budget keeps us from flip flopping every frame
+			++m_iBudgetedMaxViewDepth;
+		}
+	}
+
+	m_iRecursionBudgetFrame = gpGlobals->framecount;
+	m_fNestedViewTimeThisFrame = 0.0f;
+}
+
+
 //-----------------------------------------------------------------------------
 // Returns the current View IDs 
 //-----------------------------------------------------------------------------
@@ -175,6 +175,18 @@ public:
 	// lets portals know that they should do "end of the line" kludges to cover up that portals don't go infinitely recursive
 	int	GetRemainingPortalViewDepth() const;
 
+	// Per recursion level detail reduction. Level 0 is the primary view and is never reduced
+	float GetViewDistanceScale( int iRecursionLevel ) const; //multiplier for zFar and max renderable distance
+	bool ShouldDrawDetailObjects( int iRecursionLevel ) const;
+	bool ShouldUpdateShadowTextures( int iRecursionLevel ) const;
+
+	// Tests a world space box against the clipped portal polygon frustum of the view being rendered. Returns true if the box can't be seen.
+	// Never culls anything in the primary view. Only call it while building the portal's own view, not the views rendered inside it.
+	bool CullBoxAgainstPortalView( const Vector &vMins, const Vector &vMaxs ) const;
+
+	// Maximum view depth the recursion time budget currently allows, independent of r_portal_stencil_depth
+	int GetBudgetedMaxViewDepth() const { return m_iBudgetedMaxViewDepth; }
+
 	inline CPortalRenderable *GetCurrentViewEntryPortal( void ) const { return m_pRenderingViewForPortal; }; //if rendering a portal view, this is the portal the current view enters into
 	inline CPortalRenderable *GetCurrentViewExitPortal( void ) const { return m_pRenderingViewExitPortal; }; //if rendering a portal view, this is the portal the current view exits from
 
@@ -237,6 +249,7 @@ private:
 	PortalViewIDNode_t* m_PortalViewIDNodeChain[MAX_PORTAL_RECURSIVE_VIEWS]; //the view id node chain we're following, 0 always being &m_HeadPortalViewIDNode (offsetting by 1 seems like it'd cause bugs in the long run)
 	
 	void UpdatePortalPixelVisibility( void ); //updates pixel visibility for portal surfaces
+	void UpdateRecursionBudget( void ); //adjusts m_iBudgetedMaxViewDepth from last frame's nested view time
 
 	// Handles a portal update message
 	void HandlePortalUpdateMessage( KeyValues *pKeyValues );
@@ -251,6 +264,10 @@ private:
 	PortalRenderingMaterials_t	m_Materials;
 	int							m_iViewRecursionLevel;
 	int							m_iRemainingPortalViewDepth; //let's portals know that they should do "end of the line" kludges to cover up that portals don't go infinitely recursive
+
+	int							m_iBudgetedMaxViewDepth; //view depth allowed by r_portal_recursion_budget_ms
+	int							m_iRecursionBudgetFrame; //frame m_fNestedViewTimeThisFrame was accumulated for
+	float						m_fNestedViewTimeThisFrame; //milliseconds spent rendering views through portals this frame
 		
 	CPortalRenderable			*m_pRenderingViewForPortal; //the specific pointer for the portal that we're rending a view for
 	CPortalRenderable			*m_pRenderingViewExitPortal; //the specific pointer for the portal that our view exits from
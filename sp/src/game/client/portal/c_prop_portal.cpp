@@ -162,6 +162,8 @@ void __MsgFunc_EntityPortalled(bf_read &msg)
 	}
 }
 
+static ConVar cl_portal_ghost_pool_frames( "cl_portal_ghost_pool_frames", "60", FCVAR_CHEAT, "Frames to keep an unused ghost renderable around in case its entity comes back to the portal." );
+static ConVar cl_portal_ghost_cull( "cl_portal_ghost_cull", "1", FCVAR_CHEAT, "Keep ghost renderables that are entirely behind the linked portal out of the leaf system." );
 static ConVar portal_demohack( "portal_demohack", "0", FCVAR_ARCHIVE, "Do the demo_legacy_rollback setting to help during demo playback of going through portals." );
 
 class C_PortalInitHelper : public CAutoGameSystem
@@ -187,11 +189,13 @@ C_Prop_Portal::C_Prop_Portal( void )
 {
 	TransformedLighting.m_LightShadowHandle = CLIENTSHADOW_INVALID_HANDLE;
 	CProp_Portal_Shared::AllPortals.AddToTail( this );
+	CProp_Portal_Shared::AddToSpatialIndex( this );
 }
 
 C_Prop_Portal::~C_Prop_Portal( void )
 {
 	CProp_Portal_Shared::AllPortals.FindAndRemove( this );
+	CProp_Portal_Shared::RemoveFromSpatialIndex( this );
 	g_pPortalRender->RemovePortal( this );
 
 	for( int i = m_GhostRenderables.Count(); --i >= 0; )
@@ -377,28 +381,42 @@ void C_Prop_Portal::Simulate()
 		}
 	}
 
-	//now, fix up our list of ghosted renderables.
+	//ensure the shared clip plane is up to date before the ghosts are culled against it
+	C_Prop_Portal *pLinkedPortal = m_hLinkedPortal.Get();
+
+	m_fGhostRenderablesClip[0] = pLinkedPortal->m_plane_Origin.normal.x;
+	m_fGhostRenderablesClip[1] = pLinkedPortal->m_plane_Origin.normal.y;
+	m_fGhostRenderablesClip[2] = pLinkedPortal->m_plane_Origin.normal.z;
+	m_fGhostRenderablesClip[3] = pLinkedPortal->m_plane_Origin.dist - 0.75f;
+
+	//now, fix up our list of ghosted renderables. Ghosts are matched by source entity and updated in place,
+	//ones whose entity left the portal hole are pooled for a while since entities tend to wobble in and out of it
 	{
-		bool *bStillInUse = (bool *)stackalloc( sizeof( bool ) * (m_GhostRenderables.Count() + m_hGhostingEntities.Count()) );
-		memset( bStillInUse, 0, sizeof( bool ) * (m_GhostRenderables.Count() + m_hGhostingEntities.Count()) );
+		const int iFrame = gpGlobals->framecount;
+		const bool bCull = cl_portal_ghost_cull.GetBool();
 
 		for( int i = m_hGhostingEntities.Count(); --i >= 0; )
 		{
 			C_BaseEntity *pRenderable = m_hGhostingEntities[i].Get();
 
-			int j;
-			for( j = m_GhostRenderables.Count(); --j >= 0; )
+			C_PortalGhostRenderable *pGhost = NULL;
+			for( int j = m_GhostRenderables.Count(); --j >= 0; )
 			{
-				if( pRenderable == m_GhostRenderables[j]->m_pGhostedRenderable )
+				if( pRenderable == m_GhostRenderables[j]->m_hGhostSource.Get() )
 				{
-					bStillInUse[j] = true;
-					m_GhostRenderables[j]->PerFrameUpdate();
+					pGhost = m_GhostRenderables[j];
 					break;
 				}
 			}
-			
-			if ( j >= 0 )
+
+			if( pGhost )
+			{
+				pGhost->m_pGhostedRenderable = pRenderable;
+				pGhost->m_iLastGhostedFrame = iFrame;
+				pGhost->PerFrameUpdate();
+				pGhost->SetInLeafSystem( !(bCull && pGhost->IsEntirelyClipped()) );
 				continue;
+			}
 
 			//newly added
 			C_BaseEntity *pEntity = m_hGhostingEntities[i];
@@ -416,8 +434,9 @@ void C_Prop_Portal::Simulate()
 																				(pEntity == pLocalPlayer || bIsHeldWeapon) );
 			Assert( pNewGhost );
 
-			bStillInUse[ m_GhostRenderables.AddToTail( pNewGhost ) ] = true;
+			m_GhostRenderables.AddToTail( pNewGhost );
 			pNewGhost->PerFrameUpdate();
+			pNewGhost->SetInLeafSystem( !(bCull && pNewGhost->IsEntirelyClipped()) );
 
 			// HACK - I just copied the CClientTools::OnEntityCreated code here,
 			// since the ghosts aren't really entities - they don't have an entindex,
@@ -435,18 +454,26 @@ void C_Prop_Portal::Simulate()
 			}
 		}
 
-		//remove unused ghosts
+		//pool or remove unused ghosts
+		const int iPoolFrames = cl_portal_ghost_pool_frames.GetInt();
 		for ( int i = m_GhostRenderables.Count(); --i >= 0; )
 		{
-			if ( bStillInUse[i] )
+			C_PortalGhostRenderable *pGhost = m_GhostRenderables[i];
+			if ( pGhost->m_iLastGhostedFrame == iFrame )
 				continue;
 
+			if ( (pGhost->m_hGhostSource.Get() != NULL) && ((iFrame - pGhost->m_iLastGhostedFrame) <= iPoolFrames) )
+			{
+				pGhost->SetInLeafSystem( false );
+				pGhost->m_pGhostedRenderable = NULL;
+				continue;
+			}
+
 			// HACK - I just copied the CClientTools::OnEntityDeleted code here,
 			// since the ghosts aren't really entities - they don't have an entindex,
 			// they're not in the entitylist, and they get created during Simulate(),
 			// which isn't valid for real entities, since it changes the simulate list
 			// -jd
-			C_PortalGhostRenderable *pGhost = m_GhostRenderables[i];
 			if ( ToolsEnabled() )
 			{
 				HTOOLHANDLE handle = pGhost ? pGhost->GetToolHandle() : (HTOOLHANDLE)0;
@@ -468,14 +495,6 @@ void C_Prop_Portal::Simulate()
 			m_GhostRenderables.FastRemove( i );
 		}
 	}
-
-	//ensure the shared clip plane is up to date
-	C_Prop_Portal *pLinkedPortal = m_hLinkedPortal.Get();
-
-	m_fGhostRenderablesClip[0] = pLinkedPortal->m_plane_Origin.normal.x;
-	m_fGhostRenderablesClip[1] = pLinkedPortal->m_plane_Origin.normal.y;
-	m_fGhostRenderablesClip[2] = pLinkedPortal->m_plane_Origin.normal.z;
-	m_fGhostRenderablesClip[3] = pLinkedPortal->m_plane_Origin.dist - 0.75f;
 }
 
 void C_Prop_Portal::UpdateOnRemove( void )
@@ -840,7 +859,8 @@ void C_Prop_Portal::UpdateGhostRenderables( void )
 	//lastly, update all ghost renderables
 	for( int i = m_GhostRenderables.Count(); --i >= 0; )
 	{
-		m_GhostRenderables[i]->m_matGhostTransform = m_matrixThisToLinked;;
+		m_GhostRenderables[i]->m_matGhostTransform = m_matrixThisToLinked;
+		m_GhostRenderables[i]->InvalidateBoneCache();
 	}
 }
 
@@ -900,6 +920,8 @@ void C_Prop_Portal::UpdateOriginPlane( void )
 	m_plane_Origin.dist = m_plane_Origin.normal.Dot( GetAbsOrigin() );
 	m_plane_Origin.signbits = SignbitsForPlane( &m_plane_Origin );
 
+	CProp_Portal_Shared::UpdateSpatialIndex( this );
+
 	Vector vAbsNormal;
 	vAbsNormal.x = fabs(m_plane_Origin.normal.x);
 	vAbsNormal.y = fabs(m_plane_Origin.normal.y);
@@ -450,6 +450,14 @@ void CPortalRenderable_FlatBasic::RenderPortalViewToBackBuffer( CViewRender *pVi
 	if( portalView.zNear < 1.0f )
 		portalView.zNear = 1.0f;
 
+	//pull the far plane in for deeper views, cameraView already has the scale for the current level applied
+	{
+		int iRecursionLevel = g_pPortalRender->GetViewRecursionLevel();
+		portalView.zFar *= g_pPortalRender->GetViewDistanceScale( iRecursionLevel + 1 ) / g_pPortalRender->GetViewDistanceScale( iRecursionLevel );
+		if( portalView.zFar < portalView.zNear + 1.0f )
+			portalView.zFar = portalView.zNear + 1.0f;
+	}
+
 	QAngle qPOVAngles = TransformAnglesToWorldSpace( cameraView.angles, m_matrixThisToLinked.As3x4() );	
 
 	portalView.width = cameraView.width;
@@ -3317,6 +3317,17 @@ void CRendering3dView::SetupRenderablesList( int viewID )
 
 		float fMaxDist = cl_maxrenderable_dist.GetFloat();
 
+#ifdef PORTAL
+		// Views deep inside portals get fewer renderables
+		int iPortalRecursionLevel = g_pPortalRender->GetViewRecursionLevel();
+		fMaxDist *= g_pPortalRender->GetViewDistanceScale( iPortalRecursionLevel );
+		setupInfo.m_bDrawDetailObjects = setupInfo.m_bDrawDetailObjects && g_pPortalRender->ShouldDrawDetailObjects( iPortalRecursionLevel );
+
+		// Only the portal's own view looks through the clipped portal polygon, the skybox, water and
+		// shadow depth views rendered from inside it have their own cameras
+		setupInfo.m_bCullAgainstPortalView = (iPortalRecursionLevel != 0) && (viewID == g_pPortalRender->GetCurrentViewId());
+#endif
+
 		// Shadowing light typically has a smaller farz than cl_maxrenderable_dist
 		setupInfo.m_flRenderDistSq = (viewID == VIEW_SHADOW_DEPTH_TEXTURE) ? MIN(zFar, fMaxDist) : fMaxDist;
 		setupInfo.m_flRenderDistSq *= setupInfo.m_flRenderDistSq;
@@ -5355,9 +5366,14 @@ void CBaseWorldView::DrawExecute( float waterHeight, view_id_t viewID, float wat
 
 	// @MULTICORE (toml 8/16/2006): rethink how, where, and when this is done...
 	g_CurrentViewID = VIEW_SHADOW_DEPTH_TEXTURE;
-	MaybeInvalidateLocalPlayerAnimation();
-	g_pClientShadowMgr->ComputeShadowTextures( *this, m_pWorldListInfo->m_LeafCount, m_pWorldListInfo->m_pLeafList );
-	MaybeInvalidateLocalPlayerAnimation();
+#ifdef PORTAL
+	if ( g_pPortalRender->ShouldUpdateShadowTextures( g_pPortalRender->GetViewRecursionLevel() ) )
+#endif
+	{
+		MaybeInvalidateLocalPlayerAnimation();
+		g_pClientShadowMgr->ComputeShadowTextures( *this, m_pWorldListInfo->m_LeafCount, m_pWorldListInfo->m_pLeafList );
+		MaybeInvalidateLocalPlayerAnimation();
+	}
 
 	// Make sure sound doesn't stutter
 	engine->Sound_ExtraUpdate();
@@ -105,16 +105,19 @@ void CPhysicsCloneArea::UpdatePosition( void )
 {
 	Assert( m_pAttachedPortal );
 
-	//untouch everything we're touching
+	//don't want to risk list corruption while untouching
+	CUtlVector<CBaseEntity *> TouchingEnts;
 	touchlink_t *root = ( touchlink_t * )GetDataObject( TOUCHLINK );
 	if( root )
 	{
-		//don't want to risk list corruption while untouching
-		CUtlVector<CBaseEntity *> TouchingEnts;
 		for( touchlink_t *link = root->nextLink; link != root; link = link->nextLink )
 			TouchingEnts.AddToTail( link->entityTouched );
+	}
 
-
+	bool bStaysActive = m_bActive && m_pAttachedPortal->m_bActivated;
+	if( !bStaysActive )
+	{
+		//activation is changing, untouch everything we're touching so every entity gets a fresh start/end touch in the new state
 		for( int i = TouchingEnts.Count(); --i >= 0; )
 		{
 			CBaseEntity *pTouch = TouchingEnts[i];
@@ -122,6 +125,7 @@ void CPhysicsCloneArea::UpdatePosition( void )
 			pTouch->PhysicsNotifyOtherOfUntouch( pTouch, this );
 			PhysicsNotifyOtherOfUntouch( this, pTouch );
 		}
+		TouchingEnts.RemoveAll();
 	}
 
 	SetAbsOrigin( m_pAttachedPortal->GetAbsOrigin() );
@@ -130,14 +134,37 @@ void CPhysicsCloneArea::UpdatePosition( void )
 
 	//NDebugOverlay::EntityBounds( this, 0, 0, 255, 25, 5.0f );
 
+	CBaseEntity *pNearbyEnts[1024];
+	int iNearbyCount = FindNearbyEntities( pNearbyEnts, ARRAYSIZE( pNearbyEnts ) );
+
+	if( TouchingEnts.Count() != 0 )
+	{
+		//Staying active while moving, so only entities that got left outside the new area stop cloning.
+		//Everything still inside keeps its clone instead of being torn down and recloned.
+		CBitVec<MAX_EDICTS> StillNearby;
+		StillNearby.ClearAll();
+		for( int i = 0; i != iNearbyCount; ++i )
+			StillNearby.Set( pNearbyEnts[i]->entindex() );
+
+		for( int i = TouchingEnts.Count(); --i >= 0; )
+		{
+			CBaseEntity *pTouch = TouchingEnts[i];
+			if( StillNearby.IsBitSet( pTouch->entindex() ) )
+				continue;
+
+			pTouch->PhysicsNotifyOtherOfUntouch( pTouch, this );
+			PhysicsNotifyOtherOfUntouch( this, pTouch );
+		}
+	}
+
 	//RemoveFlag( FL_DONTTOUCH );
-	CloneNearbyEntities(); //wake new objects so they can figure out that they touch
+
+	//wake new objects so they can figure out that they touch. Entities that were already touching just have their touch refreshed, only newcomers get a StartTouch()
+	MarkEntitiesAsTouching( pNearbyEnts, iNearbyCount );
 }
 
-void CPhysicsCloneArea::CloneNearbyEntities( void )
+int CPhysicsCloneArea::FindNearbyEntities( CBaseEntity **pList, int listMax )
 {
-	CBaseEntity*	pList[ 1024 ];
-
 	Vector vForward, vUp, vRight;
 	GetVectors( &vForward, &vRight, &vUp );
 
@@ -181,12 +208,10 @@ void CPhysicsCloneArea::CloneNearbyEntities( void )
 	}*/
 	
 
-	int count = UTIL_EntitiesInBox( pList, 1024, vAABBMins, vAABBMaxs, 0 );
-	trace_t tr;
-	UTIL_ClearTrace( tr );
-	
+	int count = UTIL_EntitiesInBox( pList, listMax, vAABBMins, vAABBMaxs, 0 );
+	int iNearbyCount = 0;
 
-	//Iterate over all the possible targets
+	//Iterate over all the possible targets, compacting the list down to the ones we want
 	for ( int i = 0; i < count; i++ )
 	{
 		CBaseEntity *pEntity = pList[i];
@@ -204,16 +229,39 @@ void CPhysicsCloneArea::CloneNearbyEntities( void )
 				if( IsOBBIntersectingOBB( ptOrigin, qAngles, vLocalMins, vLocalMaxs, 
 					ptEntityCenter, pEntCollision->GetCollisionAngles(), pEntCollision->OBBMins(), pEntCollision->OBBMaxs() ) )
 				{
-					tr.endpos = (ptOrigin + ptEntityCenter) * 0.5;
-					PhysicsMarkEntitiesAsTouching( pEntity, tr );
-					//StartTouch( pEntity );
-					
-					//pEntity->WakeRestingObjects();
-					//pPhysicsObject->Wake();
+					pList[iNearbyCount] = pEntity;
+					++iNearbyCount;
 				}
 			}
 		}
 	}
+
+	return iNearbyCount;
+}
+
+void CPhysicsCloneArea::CloneNearbyEntities( void )
+{
+	CBaseEntity*	pList[ 1024 ];
+	int count = FindNearbyEntities( pList, 1024 );
+
+	MarkEntitiesAsTouching( pList, count );
+}
+
+void CPhysicsCloneArea::MarkEntitiesAsTouching( CBaseEntity **pList, int iCount )
+{
+	Vector ptOrigin = GetAbsOrigin();
+	trace_t tr;
+	UTIL_ClearTrace( tr );
+
+	for ( int i = 0; i < iCount; i++ )
+	{
+		tr.endpos = (ptOrigin + pList[i]->CollisionProp()->GetCollisionOrigin()) * 0.5;
+		PhysicsMarkEntitiesAsTouching( pList[i], tr );
+		//StartTouch( pEntity );
+		
+		//pEntity->WakeRestingObjects();
+		//pPhysicsObject->Wake();
+	}
 }
 
 void CPhysicsCloneArea::CloneTouchingEntities( void )
@@ -39,6 +39,8 @@ public:
 	void					CloneNearbyEntities( void );
 	static CPhysicsCloneArea *CreatePhysicsCloneArea( CProp_Portal *pFollowPortal );	
 private:
+	int						FindNearbyEntities( CBaseEntity **pList, int listMax ); //physics entities whose OBBs actually intersect the clone area
+	void					MarkEntitiesAsTouching( CBaseEntity **pList, int iCount );
 
 	CProp_Portal			*m_pAttachedPortal;
 	CPortalSimulator		*m_pAttachedSimulator;
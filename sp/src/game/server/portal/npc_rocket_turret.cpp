@@ -150,7 +150,8 @@ protected:
 	void	UpdateSkin( int nSkin );
 	void	UpdateMuzzleMatrix ( void );
 
-	bool	TestLOS( const Vector& vAimPoint );
+	void	BuildLOSRay( const Vector& vAimPoint, Ray_t *pRay );
+	bool	TestLOS( const Ray_t& ray, const CProp_Portal *pFirstPortal );
 	bool	TestPortalsForLOS( Vector* pOutVec, bool bConsiderNonPortalAimPoint );
 	bool	FindAimPointThroughPortal( const CProp_Portal* pPortal, Vector* pVecOut );
 	void	SyncPoseToAimAngles ( void );
@@ -929,11 +930,11 @@ float CNPC_RocketTurret::UpdateFacing( void )
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Tests if this prop's front point will have direct line of sight to it's target entity once the pose parameters are set to face it
+// Purpose: Builds the sight line this prop's front point will have to vAimPoint once the pose parameters are set to face it
 // Input  : vAimPoint - The point to aim at
-// Output : Returns true if target is in direct line of sight, false otherwise.
+//			pRay - Output ray from the muzzle to vAimPoint
 //-----------------------------------------------------------------------------
-bool CNPC_RocketTurret::TestLOS( const Vector& vAimPoint )
+void CNPC_RocketTurret::BuildLOSRay( const Vector& vAimPoint, Ray_t *pRay )
 {
 	// Snap to face (for accurate traces)
 	QAngle vecOldAngles = m_vecCurrentAngles.m_Value;
@@ -942,18 +943,26 @@ bool CNPC_RocketTurret::TestLOS( const Vector& vAimPoint )
 	SyncPoseToAimAngles();
 
 	Vector vFaceOrigin = EyePosition();
-	trace_t trTarget;
-	Ray_t ray;
-	ray.Init( vFaceOrigin, vAimPoint );
-	ray.m_IsRay = true;
-
-	// This aim point does hit target, now make sure there are no blocking objects in the way
-	CTraceFilterSimple filter ( this, COLLISION_GROUP_NONE );
-	UTIL_Portal_TraceRay( ray, MASK_VISIBLE_AND_NPCS, &filter, &trTarget, false );
+	pRay->Init( vFaceOrigin, vAimPoint );
+	pRay->m_IsRay = true;
 
 	// Set model back to current facing
 	m_vecCurrentAngles = vecOldAngles;
 	SyncPoseToAimAngles();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tests if this prop's front point will have direct line of sight to it's target entity along a sight line from BuildLOSRay()
+// Input  : ray - The sight line
+//			pFirstPortal - The first portal along the sight line, or NULL if it doesn't pass through one
+// Output : Returns true if target is in direct line of sight, false otherwise.
+//-----------------------------------------------------------------------------
+bool CNPC_RocketTurret::TestLOS( const Ray_t& ray, const CProp_Portal *pFirstPortal )
+{
+	// This aim point does hit target, now make sure there are no blocking objects in the way
+	trace_t trTarget;
+	CTraceFilterSimple filter ( this, COLLISION_GROUP_NONE );
+	UTIL_Portal_TraceRay_With( pFirstPortal, ray, MASK_VISIBLE_AND_NPCS, &filter, &trTarget, false );
 
 	return ( trTarget.m_pEnt == GetEnemy() );
 }
@@ -1030,20 +1039,47 @@ bool CNPC_RocketTurret::TestPortalsForLOS( Vector* pOutVec, bool bConsiderNonPor
 		fHighestDot			= DotProduct( vecToEnemy, vCurAim );
 	}
 
-	// Compare aim points, use the closest aim point which has direct LOS
-	for( int i = 0; i != iPortalCount; ++i )
+	// Compare aim points, use the closest aim point which has direct LOS.
+	// Sight lines are gathered four at a time so finding the portals they pass through is one batched test.
+	Ray_t losRays[4];
+	int iLOSPortalIndex[4];
+	int iLOSCount = 0;
+
+	for( int i = 0; i <= iPortalCount; ++i )
 	{
-		if( bUsable[i] )
+		if( i != iPortalCount )
+		{
+			if( !bUsable[i] )
+				continue;
+
+			BuildLOSRay( portalAimPoints[ i ], &losRays[ iLOSCount ] );
+			iLOSPortalIndex[ iLOSCount ] = i;
+			if( ++iLOSCount != ARRAYSIZE( losRays ) )
+				continue;
+		}
+
+		if( iLOSCount == 0 )
+			continue;
+
+		float fMustBeCloserThan[4] = { 2.0f, 2.0f, 2.0f, 2.0f };
+		CProp_Portal *pFirstPortals[4];
+		UTIL_Portal_FirstAlongRays( losRays, iLOSCount, fMustBeCloserThan, pFirstPortals );
+
+		for( int j = 0; j != iLOSCount; ++j )
 		{
+			int iAimPoint = iLOSPortalIndex[ j ];
+
 			// This aim point has direct LOS
-			if ( TestLOS( portalAimPoints[ i ] ) && fHighestDot < fPortalDot[ i ] )
+			if ( TestLOS( losRays[ j ], pFirstPortals[ j ] ) && fHighestDot < fPortalDot[ iAimPoint ] )
 			{
-				*pOutVec = portalAimPoints[ i ];
-				fHighestDot = fPortalDot[ i ];
+				*pOutVec = portalAimPoints[ iAimPoint ];
+				fHighestDot = fPortalDot[ iAimPoint ];
 
 				++iCountPortalsThatSeeTarget;
 			}
 		}
+
+		iLOSCount = 0;
 	}
 
 	return (iCountPortalsThatSeeTarget != 0);
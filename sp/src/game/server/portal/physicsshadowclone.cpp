@@ -13,6 +13,8 @@
 #include "props.h"
 #include "model_types.h"
 #include "portal/weapon_physcannon.h" //grab controllers
+#include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 
 #include "portalsimulation.h"
 
@@ -21,6 +23,8 @@
 static int g_iShadowCloneCount = 0;
 ConVar sv_debug_physicsshadowclones("sv_debug_physicsshadowclones", "0", FCVAR_REPLICATED );
 ConVar sv_use_shadow_clones( "sv_use_shadow_clones", "1", FCVAR_REPLICATED | FCVAR_CHEAT ); //should we create shadow clones?
+ConVar sv_shadowclone_sync_threaded( "sv_shadowclone_sync_threaded", "1", FCVAR_CHEAT, "Check which shadow clones need a full sync on the thread pool. The syncs themselves always run on the main thread." );
+ConVar sv_shadowclone_sync_dirty_only( "sv_shadowclone_sync_dirty_only", "1", FCVAR_CHEAT, "Skip the per frame full sync of shadow clones whose source physics objects are asleep and haven't changed since their last sync." );
 
 static void DrawDebugOverlayForShadowClone( CPhysicsShadowClone *pClone );
 
@@ -64,6 +68,7 @@ CPhysicsShadowClone::CPhysicsShadowClone( void )
 	m_matrixShadowTransform.Identity();
 	m_matrixShadowTransform_Inverse.Identity();
 	m_bShadowTransformIsIdentity = true;
+	m_bSyncDirty = true;
 	s_ActiveShadowClones.AddToTail( this );
 }
 
@@ -341,6 +346,8 @@ void CPhysicsShadowClone::FullSync( bool bAllowAssumedSync )
 	if( bBigChanges )
 		CollisionRulesChanged();
 
+	RecordSyncedState();
+
 	if( sv_debug_physicsshadowclones.GetBool() )
 		DrawDebugOverlayForShadowClone( this );
 }
@@ -757,6 +764,8 @@ void CPhysicsShadowClone::PartialSync( bool bPullChanges )
 	}
 
 	SyncEntity( bPullChanges );
+
+	m_bSyncDirty = true;
 }
 
 
@@ -784,6 +793,7 @@ void CPhysicsShadowClone::VPhysicsDestroyObject( void )
 		m_pOwnerPhysEnvironment->DestroyObject(	m_CloneLinks[i].pClone );
 	}
 	m_CloneLinks.RemoveAll();
+	m_bSyncDirty = true;
 
 	SetMoveType( MOVETYPE_NONE );
 	SetSolid( SOLID_NONE );
@@ -1008,12 +1018,157 @@ void CPhysicsShadowClone::Free( void )
 }
 
 
+//Deciding whether a clone needs a sync only reads from the source and clone physics objects, so it can be split across
+//the thread pool. Actually syncing writes to entities and physics objects and stays on the main thread.
+#define SHADOWCLONE_SYNC_JOB_SIZE 16
+#define SHADOWCLONE_SYNC_MIN_THREADED_CLONES 32
+
+struct ShadowCloneSyncJob_t
+{
+	int iFirstClone;
+	int iCloneCount;
+};
+
+static CPhysicsShadowClone * const *s_pGatherClones = NULL;
+static bool *s_pGatherNeedsSync = NULL;
+
+void CPhysicsShadowClone::GatherSyncState( ShadowCloneSyncJob_t &job )
+{
+	for( int i = job.iFirstClone; i != job.iFirstClone + job.iCloneCount; ++i )
+	{
+		s_pGatherNeedsSync[i] = s_pGatherClones[i]->NeedsSync();
+	}
+}
+
 void CPhysicsShadowClone::FullSyncAllClones( void )
 {
-	for( int i = s_ActiveShadowClones.Count(); --i >= 0; )
+	VPROF_BUDGET( "CPhysicsShadowClone::FullSyncAllClones", VPROF_BUDGETGROUP_PHYSICS );
+
+	int iCloneCount = s_ActiveShadowClones.Count();
+	if( iCloneCount == 0 )
+		return;
+
+	bool bDirtyOnly = sv_shadowclone_sync_dirty_only.GetBool();
+	int iSynced = 0;
+	int iSkipped = 0;
+
+	CPhysicsShadowClone **pClones = s_ActiveShadowClones.Base();
+	bool *pNeedsSync = (bool *)stackalloc( sizeof( bool ) * iCloneCount );
+
+	if( bDirtyOnly )
+	{
+		VPROF( "CPhysicsShadowClone::FullSyncAllClones gather" );
+
+		s_pGatherClones = pClones;
+		s_pGatherNeedsSync = pNeedsSync;
+
+		if( sv_shadowclone_sync_threaded.GetBool() && (iCloneCount >= SHADOWCLONE_SYNC_MIN_THREADED_CLONES) )
+		{
+			int iJobCount = (iCloneCount + SHADOWCLONE_SYNC_JOB_SIZE - 1) / SHADOWCLONE_SYNC_JOB_SIZE;
+			ShadowCloneSyncJob_t *pJobs = (ShadowCloneSyncJob_t *)stackalloc( sizeof( ShadowCloneSyncJob_t ) * iJobCount );
+			for( int i = 0; i != iJobCount; ++i )
+			{
+				pJobs[i].iFirstClone = i * SHADOWCLONE_SYNC_JOB_SIZE;
+				pJobs[i].iCloneCount = MIN( SHADOWCLONE_SYNC_JOB_SIZE, iCloneCount - pJobs[i].iFirstClone );
+			}
+
+			ParallelProcess( "CPhysicsShadowClone::GatherSyncState", pJobs, iJobCount, &CPhysicsShadowClone::GatherSyncState );
+			VPROF_INCREMENT_COUNTER( "ShadowClones gathered threaded", iCloneCount );
+		}
+		else
+		{
+			ShadowCloneSyncJob_t job;
+			job.iFirstClone = 0;
+			job.iCloneCount = iCloneCount;
+			GatherSyncState( job );
+			VPROF_INCREMENT_COUNTER( "ShadowClones gathered serial", iCloneCount );
+		}
+
+		s_pGatherClones = NULL;
+		s_pGatherNeedsSync = NULL;
+	}
+	else
+	{
+		memset( pNeedsSync, 1, sizeof( bool ) * iCloneCount );
+	}
+
+	{
+		VPROF( "CPhysicsShadowClone::FullSyncAllClones apply" );
+
+		for( int i = iCloneCount; --i >= 0; )
+		{
+			if( !pNeedsSync[i] )
+			{
+				++iSkipped;
+				continue;
+			}
+
+			pClones[i]->FullSync( true );
+			++iSynced;
+		}
+	}
+
+	VPROF_INCREMENT_COUNTER( "ShadowClones synced", iSynced );
+	VPROF_INCREMENT_COUNTER( "ShadowClones skipped", iSkipped );
+}
+
+bool CPhysicsShadowClone::NeedsSync( void )
+{
+	if( m_bSyncDirty || m_bShouldUpSync )
+		return true;
+
+	CBaseEntity *pClonedEntity = m_hClonedEntity.Get();
+	if( pClonedEntity == NULL )
+		return true; //FullSync() takes care of shutting down orphaned clones
+
+	IPhysicsObject *pSourceObjects[1024];
+	int iObjectCount = pClonedEntity->VPhysicsGetObjectList( pSourceObjects, 1024 );
+
+	if( iObjectCount != m_CloneLinks.Count() )
+		return true;
+
+	for( int i = 0; i != iObjectCount; ++i )
+	{
+		const PhysicsObjectCloneLink_t &link = m_CloneLinks[i];
+		IPhysicsObject *pSourcePhysics = pSourceObjects[i];
+
+		if( pSourcePhysics != link.pSource )
+			return true;
+
+		//anything simulating on either side has to sync every frame. An asleep clone hasn't been disturbed by anything in its own environment since we last placed it
+		if( !pSourcePhysics->IsAsleep() || !link.pClone->IsAsleep() )
+			return true;
+
+		//shadow controlled and held objects get new targets without necessarily waking up
+		if( (pSourcePhysics->GetShadowController() != NULL) || (pSourcePhysics->GetGameFlags() & FVPHYSICS_PLAYER_HELD) )
+			return true;
+
+		if( (pSourcePhysics->IsCollisionEnabled() != link.bSyncedSourceCollisionEnabled) ||
+			(pSourcePhysics->IsMotionEnabled() != link.bSyncedSourceMotionEnabled) )
+			return true;
+
+		Vector ptSourcePosition;
+		QAngle qSourceAngles;
+		pSourcePhysics->GetPosition( &ptSourcePosition, &qSourceAngles );
+
+		if( (ptSourcePosition != link.ptSyncedSourcePosition) || (qSourceAngles != link.qSyncedSourceAngles) )
+			return true;
+	}
+
+	return false;
+}
+
+void CPhysicsShadowClone::RecordSyncedState( void )
+{
+	for( int i = m_CloneLinks.Count(); --i >= 0; )
 	{
-		s_ActiveShadowClones[i]->FullSync( true );
+		PhysicsObjectCloneLink_t &link = m_CloneLinks[i];
+		link.pSource->GetPosition( &link.ptSyncedSourcePosition, &link.qSyncedSourceAngles );
+		link.bSyncedSourceCollisionEnabled = link.pSource->IsCollisionEnabled();
+		link.bSyncedSourceMotionEnabled = link.pSource->IsMotionEnabled();
 	}
+
+	m_bSyncDirty = false;
 }
 
 
@@ -23,6 +23,12 @@ struct PhysicsObjectCloneLink_t
 	IPhysicsObject *pSource;
 	IPhysicsShadowController *pShadowController;
 	IPhysicsObject *pClone;
+
+	//source state as of the last full sync, lets FullSyncAllClones() skip clones of objects that haven't changed
+	Vector ptSyncedSourcePosition;
+	QAngle qSyncedSourceAngles;
+	bool bSyncedSourceCollisionEnabled;
+	bool bSyncedSourceMotionEnabled;
 };
 
 struct CPhysicsShadowCloneLL
@@ -33,6 +39,8 @@ struct CPhysicsShadowCloneLL
 
 #define FVPHYSICS_IS_SHADOWCLONE 0x4000
 
+struct ShadowCloneSyncJob_t;
+
 class CPhysicsShadowClone : public CBaseAnimating
 {
 	DECLARE_CLASS( CPhysicsShadowClone, CBaseAnimating );
@@ -46,10 +54,16 @@ private:
 	bool			m_bShadowTransformIsIdentity; //the shadow transform doesn't update often, so we can cache this
 	bool			m_bImmovable; //cloning a track train or door, something that doesn't really work on a force-based level
 	bool			m_bInAssumedSyncState;
+	bool			m_bSyncDirty; //something happened outside of FullSync() that the clone links don't know about, sync next frame regardless
 
 	void			FullSyncClonedPhysicsObjects( bool bTeleport );
 	void			SyncEntity( bool bPullChanges );
 
+	bool			NeedsSync( void ); //has the source changed since the last full sync?
+	void			RecordSyncedState( void );
+
+	static void		GatherSyncState( ShadowCloneSyncJob_t &job ); //runs NeedsSync() for a range of clones, safe to run on worker threads
+
 	IPhysicsEnvironment *m_pOwnerPhysEnvironment; //clones exist because of multi-environment situations
 
 
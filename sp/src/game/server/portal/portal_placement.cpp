@@ -12,6 +12,7 @@
 #include "collisionutils.h"
 #include "decals.h"
 #include "physicsshadowclone.h"
+#include "tier0/fasttimer.h"
 
 
 #define MAXIMUM_BUMP_DISTANCE ( ( PORTAL_HALF_WIDTH * 2.0f ) * ( PORTAL_HALF_WIDTH * 2.0f ) + ( PORTAL_HALF_HEIGHT * 2.0f ) * ( PORTAL_HALF_HEIGHT * 2.0f ) ) / 2.0f
@@ -55,11 +56,109 @@ bool IsMaterialInList( const csurface_t &surface, char *g_ppszMaterials[] )
 	return false;
 }
 
+ConVar sv_portal_placement_surface_cache( "sv_portal_placement_surface_cache", "1", FCVAR_CHEAT, "Cache per surface no portal/pass through classification instead of string matching every placement trace" );
+
+
+//-----------------------------------------------------------------------------
+// Placement runs dozens of traces per shot and classifies every surface it hits. The answer only depends on the
+// surface name and surface prop, so remember it. Surface names handed back in traces point into collision model
+// string tables (or static strings for models), so the pointer is a stable key until the map changes.
+//-----------------------------------------------------------------------------
+enum PlacementSurfaceFlags_t
+{
+	PLACEMENT_SURFACE_PASSTHROUGH	= (1<<0),	// name is in g_ppszPortalPassThroughMaterials
+	PLACEMENT_SURFACE_STUDIO		= (1<<1),	// surface belongs to a model
+};
+
+#define PLACEMENT_SURFACE_CACHE_MAX_NAMES 4096 // bail out and rebuild if something feeds us non persistent names
+
+class CPortalPlacementSurfaceCache : public CAutoGameSystem
+{
+public:
+	CPortalPlacementSurfaceCache( void ) : CAutoGameSystem( "CPortalPlacementSurfaceCache" ), m_NameFlags( 0, 0, DefLessFunc( const void * ) )
+	{
+	}
+
+	virtual void LevelInitPreEntity( void )
+	{
+		m_NameFlags.RemoveAll();
+
+		int iSurfacePropCount = physprops->SurfacePropCount();
+		m_SurfacePropIsGlass.SetCount( iSurfacePropCount );
+		for( int i = 0; i != iSurfacePropCount; ++i )
+		{
+			const surfacedata_t *pdata = physprops->GetSurfaceData( i );
+			m_SurfacePropIsGlass[i] = ( pdata->game.material == CHAR_TEX_GLASS );
+		}
+	}
+
+	virtual void LevelShutdownPostEntity( void )
+	{
+		m_NameFlags.RemoveAll();
+		m_SurfacePropIsGlass.RemoveAll();
+	}
+
+	unsigned char GetNameFlags( const char *pszName )
+	{
+		unsigned short iIndex = m_NameFlags.Find( pszName );
+		if( iIndex != m_NameFlags.InvalidIndex() )
+			return m_NameFlags[iIndex];
+
+		unsigned char iFlags = ComputeNameFlags( pszName );
+		if( m_NameFlags.Count() >= PLACEMENT_SURFACE_CACHE_MAX_NAMES )
+		{
+			DevMsg( "Portal placement surface cache overflowed, flushing.\n" );
+			m_NameFlags.RemoveAll();
+		}
+		m_NameFlags.Insert( pszName, iFlags );
+
+		return iFlags;
+	}
+
+	bool IsGlassSurfaceProp( int iSurfaceProp )
+	{
+		if( (iSurfaceProp >= 0) && (iSurfaceProp < m_SurfacePropIsGlass.Count()) )
+			return m_SurfacePropIsGlass[iSurfaceProp];
+
+		//surface props we haven't seen (or no level loaded yet), ask the slow way
+		const surfacedata_t *pdata = physprops->GetSurfaceData( iSurfaceProp );
+		return ( pdata->game.material == CHAR_TEX_GLASS );
+	}
+
+	static unsigned char ComputeNameFlags( const char *pszName )
+	{
+		unsigned char iFlags = 0;
+
+		if ( StringHasPrefix( pszName, "**studio**" ) )
+			iFlags |= PLACEMENT_SURFACE_STUDIO;
+
+		csurface_t surface;
+		surface.name = pszName;
+		if ( IsMaterialInList( surface, g_ppszPortalPassThroughMaterials ) )
+			iFlags |= PLACEMENT_SURFACE_PASSTHROUGH;
+
+		return iFlags;
+	}
+
+private:
+	CUtlMap<const void *, unsigned char>	m_NameFlags;
+	CUtlVector<bool>						m_SurfacePropIsGlass;
+};
+
+static CPortalPlacementSurfaceCache s_PortalPlacementSurfaceCache;
+
+
 bool IsNoPortalMaterial( const csurface_t &surface )
 {
 	if ( surface.flags & SURF_NOPORTAL )
 		return true;
 
+	if ( sv_portal_placement_surface_cache.GetBool() )
+	{
+		return s_PortalPlacementSurfaceCache.IsGlassSurfaceProp( surface.surfaceProps ) ||
+			   ( s_PortalPlacementSurfaceCache.GetNameFlags( surface.name ) & PLACEMENT_SURFACE_STUDIO ) != 0;
+	}
+
 	const surfacedata_t *pdata = physprops->GetSurfaceData( surface.surfaceProps );
 	if ( pdata->game.material == CHAR_TEX_GLASS )
 		return true;
@@ -76,6 +175,9 @@ bool IsPassThroughMaterial( const csurface_t &surface )
 	if ( surface.flags & SURF_SKY )
 		return true;
 
+	if ( sv_portal_placement_surface_cache.GetBool() )
+		return ( s_PortalPlacementSurfaceCache.GetNameFlags( surface.name ) & PLACEMENT_SURFACE_PASSTHROUGH ) != 0;
+
 	if ( IsMaterialInList( surface, g_ppszPortalPassThroughMaterials ) )
 		return true;
 
@@ -1335,3 +1437,73 @@ float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin,
 
 	return fAnalogSuccessMultiplier * ( PORTAL_ANALOG_SUCCESS_NO_BUMP - PORTAL_ANALOG_SUCCESS_BUMPED ) + PORTAL_ANALOG_SUCCESS_BUMPED;
 }
+
+
+//-----------------------------------------------------------------------------
+// Placement microbenchmark. Repeatedly verifies a portal on whatever the player is looking at,
+// once with the surface cache and once without.
+//-----------------------------------------------------------------------------
+static float TimePortalPlacement( const Vector &vOrigin, const QAngle &qAngles, int iIterations, float &fResult )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	for( int i = 0; i != iIterations; ++i )
+	{
+		Vector vTestOrigin = vOrigin;
+		QAngle qTestAngles = qAngles;
+		fResult = VerifyPortalPlacement( NULL, vTestOrigin, qTestAngles, PORTAL_PLACED_BY_PLAYER, true );
+	}
+
+	timer.End();
+	return timer.GetDuration().GetMillisecondsF();
+}
+
+CON_COMMAND_F( sv_portal_placement_benchmark, "Times VerifyPortalPlacement() on the surface under the crosshair. Usage: sv_portal_placement_benchmark [iterations]", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer )
+		return;
+
+	int iIterations = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 1000;
+	iIterations = clamp( iIterations, 1, 1000000 );
+
+	Vector vStart = pPlayer->EyePosition();
+	Vector vDirection;
+	pPlayer->EyeVectors( &vDirection );
+
+	trace_t tr;
+	UTIL_TraceLine( vStart, vStart + vDirection * MAX_TRACE_LENGTH, MASK_SHOT_PORTAL, pPlayer, COLLISION_GROUP_NONE, &tr );
+	if ( tr.fraction == 1.0f )
+	{
+		Msg( "Not looking at a surface.\n" );
+		return;
+	}
+
+	// Same orientation rules as CWeaponPortalgun::TraceFirePortal()
+	Vector vUp( 0.0f, 0.0f, 1.0f );
+	if( ( tr.plane.normal.x > -0.001f && tr.plane.normal.x < 0.001f ) && ( tr.plane.normal.y > -0.001f && tr.plane.normal.y < 0.001f ) )
+	{
+		vUp = vDirection;
+	}
+
+	QAngle qAngles;
+	VectorAngles( tr.plane.normal, vUp, qAngles );
+
+	bool bCacheBackup = sv_portal_placement_surface_cache.GetBool();
+
+	for( int iPass = 0; iPass != 2; ++iPass )
+	{
+		bool bCache = ( iPass == 0 );
+		sv_portal_placement_surface_cache.SetValue( bCache );
+
+		float fResult = 0.0f;
+		float fMilliseconds = TimePortalPlacement( tr.endpos, qAngles, iIterations, fResult );
+
+		Msg( "Surface cache %s: %d placements in %.2fms, %.0f per second (result %.4f)\n",
+			bCache ? "on " : "off", iIterations, fMilliseconds,
+			( fMilliseconds > 0.0f ) ? ( iIterations * 1000.0f / fMilliseconds ) : 0.0f, fResult );
+	}
+
+	sv_portal_placement_surface_cache.SetValue( bCacheBackup );
+}
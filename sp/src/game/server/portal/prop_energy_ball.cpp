@@ -11,6 +11,7 @@
 #include "prop_portal.h"			// Special case code for passing through portals. We need the class definition.
 #include "soundenvelope.h"
 #include "physicsshadowclone.h"
+#include "tier0/fasttimer.h"
 
 // resource file names
 #define IMPACT_DECAL_NAME	"decals/smscorch1model"
@@ -18,6 +19,16 @@
 // context think
 #define UPDATE_THINK_CONTEXT	"UpdateThinkContext"
 
+ConVar sv_energy_ball_contact_trace( "sv_energy_ball_contact_trace", "1", FCVAR_CHEAT, "Trace for bounce decals toward the contact point instead of far along the pre-bounce velocity." );
+
+// Bounce handling cost, see sv_energy_ball_stats
+static struct EnergyBallStats_t
+{
+	int		iBounces;
+	int		iTraces;
+	float	fTotalMilliseconds;
+} s_EnergyBallStats;
+
 class CPropEnergyBall : public CPropCombineBall
 {
 public:
@@ -163,6 +174,9 @@ void CPropEnergyBall::VPhysicsCollision( int index, gamevcollisionevent_t *pEven
 
 	BaseClass::BaseClass::VPhysicsCollision( index, pEvent );
 
+	CFastTimer bounceTimer;
+	bounceTimer.Start();
+
 	Vector preVelocity = pEvent->preVelocity[index];
 //	float flSpeed = VectorNormalize( preVelocity );
 
@@ -218,9 +232,23 @@ void CPropEnergyBall::VPhysicsCollision( int index, gamevcollisionevent_t *pEven
 	// Plant a decal on any solid brushes we hit
 	if ( !bIsEnteringPortalAndLockingAxisForward )
 	{
+		// The contact point is right on the surface we bounced off of, so a short trace just past it finds the same
+		// surface the old trace along the (unnormalized) pre-bounce velocity did without sweeping thousands of units
+		Vector vecTraceEnd = GetAbsOrigin() + 60*preVelocity;
+		if ( sv_energy_ball_contact_trace.GetBool() )
+		{
+			Vector vecContactPoint;
+			pEvent->pInternalData->GetContactPoint( vecContactPoint );
+
+			Vector vecToContact = vecContactPoint - GetAbsOrigin();
+			if ( VectorNormalize( vecToContact ) > 0.0f )
+				vecTraceEnd = vecContactPoint + vecToContact * 4.0f;
+		}
+
 		trace_t		tr;
-		UTIL_TraceLine ( GetAbsOrigin(), GetAbsOrigin() + 60*preVelocity, MASK_SHOT, 
+		UTIL_TraceLine ( GetAbsOrigin(), vecTraceEnd, MASK_SHOT, 
 			this, COLLISION_GROUP_NONE, &tr);
+		++s_EnergyBallStats.iTraces;
 
 		// Only place decals and draw effects if we hit something valid
 		if ( tr.m_pEnt )
@@ -253,6 +281,10 @@ void CPropEnergyBall::VPhysicsCollision( int index, gamevcollisionevent_t *pEven
 	// Try to update the velocity now, however I'm told this rarely works.
 	// We will spam updates in our think function to help get us in the direction we want to go.
 	PhysCallbackSetVelocity( pEvent->pObjects[index], vecFinalVelocity ); 
+
+	bounceTimer.End();
+	++s_EnergyBallStats.iBounces;
+	s_EnergyBallStats.fTotalMilliseconds += bounceTimer.GetDuration().GetMillisecondsF();
 }
 
 void CPropEnergyBall::NotifySystemEvent(CBaseEntity *pNotify, notify_system_event_t eventType, const notify_system_event_params_t &params )
@@ -549,72 +581,119 @@ void CEnergyBallLauncher::SpawnBall()
 
 
 
-static void fire_energy_ball_f( void )
+//-----------------------------------------------------------------------------
+// Purpose: Spawns a free flying energy ball for testing
+//-----------------------------------------------------------------------------
+static CPropEnergyBall *CreateTestEnergyBall( const Vector &ptOrigin, const Vector &vDirection, float fLifetime )
 {
-	if( sv_cheats->GetBool() == false ) //heavy handed version since setting the concommand with FCVAR_CHEATS isn't working like I thought
-		return;
+	CPropEnergyBall *pBall = static_cast<CPropEnergyBall*>( CreateEntityByName( "prop_energy_ball" ) );
 
-	CBasePlayer *pPlayer = (CBasePlayer *)UTIL_GetCommandClient();
+	if ( pBall == NULL )
+		return NULL;
 
-	Vector ptEyes, vForward;
-	ptEyes = pPlayer->EyePosition();
-	pPlayer->EyeVectors( &vForward );
+	pBall->SetRadius( 12.0f );
+
+	pBall->SetAbsOrigin( ptOrigin );
+	pBall->SetSpawner( NULL );
 
+	pBall->SetSpeed( 400.0f );
+			
 
+	pBall->SetAbsVelocity( vDirection * 400.0f );
+
+	DispatchSpawn(pBall);
+	pBall->Activate();
+	pBall->SetState( CPropCombineBall::STATE_LAUNCHED );
+	pBall->SetCollisionGroup( COLLISION_GROUP_PROJECTILE );
+	pBall->m_fMinLifeAfterPortal = 5.0f;
 
+	// Additional setup of the physics object for energy ball uses
+	IPhysicsObject *pBallObj = pBall->VPhysicsGetObject();
 
+	if ( pBallObj )
 	{
-		CPropEnergyBall *pBall = static_cast<CPropEnergyBall*>( CreateEntityByName( "prop_energy_ball" ) );
+		// Make sure we dont use air drag
+		pBallObj->EnableDrag( false );
+
+		// Remove damping
+		float speed, rot;
+		speed = rot = 0.0f;
+		pBallObj->SetDamping( &speed, &rot );
 
-		if ( pBall == NULL )
-			return;
+		// HUGE rotational inertia, don't allow the ball to have any spin
+		Vector vInertia( 1e30, 1e30, 1e30 );
+		pBallObj->SetInertia( vInertia );
 
-		pBall->SetRadius( 12.0f );
+		// Low mass to let it bounce off of obstructions for certain puzzles.
+		pBallObj->SetMass( 1.0f );
+	}
 
-		pBall->SetAbsOrigin( ptEyes + (vForward * 50.0f) );
-		pBall->SetSpawner( NULL );
+	pBall->StartLifetime( fLifetime );
+	pBall->m_bIsInfiniteLife = false;
 
-		pBall->SetSpeed( 400.0f );
-				
+	// Think function, used to update time till death and avoid sleeping
+	pBall->SetNextThink ( gpGlobals->curtime + 0.1f );
 
-		pBall->SetAbsVelocity( vForward * 400.0f );
+	return pBall;
+}
 
-		DispatchSpawn(pBall);
-		pBall->Activate();
-		pBall->SetState( CPropCombineBall::STATE_LAUNCHED );
-		pBall->SetCollisionGroup( COLLISION_GROUP_PROJECTILE );
-		pBall->m_fMinLifeAfterPortal = 5.0f;
+static void fire_energy_ball_f( void )
+{
+	if( sv_cheats->GetBool() == false ) //heavy handed version since setting the concommand with FCVAR_CHEATS isn't working like I thought
+		return;
 
-		// Additional setup of the physics object for energy ball uses
-		IPhysicsObject *pBallObj = pBall->VPhysicsGetObject();
+	CBasePlayer *pPlayer = (CBasePlayer *)UTIL_GetCommandClient();
 
-		if ( pBallObj )
-		{
-			// Make sure we dont use air drag
-			pBallObj->EnableDrag( false );
+	Vector ptEyes, vForward;
+	ptEyes = pPlayer->EyePosition();
+	pPlayer->EyeVectors( &vForward );
+
+	CreateTestEnergyBall( ptEyes + (vForward * 50.0f), vForward, 10.0f );
+}
+
+//-----------------------------------------------------------------------------
+// Stress test for catcher style puzzles. Fans a bunch of balls out in front of the player so they
+// bounce around the room and through any portals in it, then sv_energy_ball_stats shows the cost.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_energy_ball_stress, "Fires a fan of energy balls and resets sv_energy_ball_stats. Usage: sv_energy_ball_stress [count] [lifetime]", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer )
+		return;
 
-			// Remove damping
-			float speed, rot;
-			speed = rot = 0.0f;
-			pBallObj->SetDamping( &speed, &rot );
+	int iCount = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 32;
+	iCount = clamp( iCount, 1, 256 );
 
-			// HUGE rotational inertia, don't allow the ball to have any spin
-			Vector vInertia( 1e30, 1e30, 1e30 );
-			pBallObj->SetInertia( vInertia );
+	float fLifetime = ( args.ArgC() > 2 ) ? atof( args[2] ) : 30.0f;
+	fLifetime = MAX( fLifetime, 1.0f );
 
-			// Low mass to let it bounce off of obstructions for certain puzzles.
-			pBallObj->SetMass( 1.0f );
-		}
+	Vector ptEyes = pPlayer->EyePosition();
+	QAngle qEyeAngles = pPlayer->EyeAngles();
 
-		pBall->StartLifetime( 10.0f );
-		pBall->m_bIsInfiniteLife = false;
+	for ( int i = 0; i != iCount; ++i )
+	{
+		// spread over a 90 degree cone so they don't all hit the same spot
+		QAngle qBallAngles = qEyeAngles;
+		qBallAngles.x += random->RandomFloat( -45.0f, 45.0f );
+		qBallAngles.y += random->RandomFloat( -45.0f, 45.0f );
 
-		// Think function, used to update time till death and avoid sleeping
-		pBall->SetNextThink ( gpGlobals->curtime + 0.1f );
+		Vector vDirection;
+		AngleVectors( qBallAngles, &vDirection );
 
+		CreateTestEnergyBall( ptEyes + (vDirection * 50.0f), vDirection, fLifetime );
 	}
 
+	memset( &s_EnergyBallStats, 0, sizeof( s_EnergyBallStats ) );
+}
+
+CON_COMMAND_F( sv_energy_ball_stats, "Prints and resets energy ball bounce handling counters.", FCVAR_CHEAT )
+{
+	const EnergyBallStats_t &stats = s_EnergyBallStats;
+	Msg( "Energy ball bounces: %d, decal traces: %d\n", stats.iBounces, stats.iTraces );
+	Msg( "  total %.3fms, average %.4fms per bounce\n", stats.fTotalMilliseconds,
+		( stats.iBounces != 0 ) ? ( stats.fTotalMilliseconds / stats.iBounces ) : 0.0f );
 
+	memset( &s_EnergyBallStats, 0, sizeof( s_EnergyBallStats ) );
 }
 
 ConCommand fire_energy_ball( "fire_energy_ball", fire_energy_ball_f, "Fires a test energy ball out of your face", FCVAR_CHEAT );
\ No newline at end of file
@@ -31,6 +31,8 @@
 #include "func_portal_orientation.h"
 #include "env_debughistory.h"
 #include "tier1/callqueue.h"
+#include "tier0/fasttimer.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -48,6 +50,16 @@ ConVar sv_portal_debug_touch("sv_portal_debug_touch", "0", FCVAR_REPLICATED );
 ConVar sv_portal_placement_never_fail("sv_portal_placement_never_fail", "0", FCVAR_REPLICATED | FCVAR_CHEAT );
 ConVar sv_portal_new_velocity_check("sv_portal_new_velocity_check", "1", FCVAR_CHEAT );
 
+// Accumulated cost of CProp_Portal::TeleportTouchingEntity(), see sv_portal_teleport_stats
+static struct PortalTeleportStats_t
+{
+	int		iTeleports;
+	int		iPlayerTeleports;
+	int		iHeldObjectFixups;
+	float	fTotalMilliseconds;
+	float	fMaxMilliseconds;
+} s_PortalTeleportStats;
+
 static CUtlVector<CProp_Portal *> s_PortalLinkageGroups[256];
 
 
@@ -155,11 +167,13 @@ CProp_Portal::CProp_Portal( void )
 	m_pCollisionShape = physcollision->ConvertConvexToCollide( &pConvex, 1 );
 
 	CProp_Portal_Shared::AllPortals.AddToTail( this );
+	CProp_Portal_Shared::AddToSpatialIndex( this );
 }
 
 CProp_Portal::~CProp_Portal( void )
 {
 	CProp_Portal_Shared::AllPortals.FindAndRemove( this );
+	CProp_Portal_Shared::RemoveFromSpatialIndex( this );
 	s_PortalLinkageGroups[m_iLinkageGroupID].FindAndRemove( this );
 }
 
@@ -931,12 +945,18 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 
 	Assert( m_hLinkedPortal.Get() != NULL );
 
+	VPROF_BUDGET( "CProp_Portal::TeleportTouchingEntity", "Portal" );
+
+	CFastTimer teleportTimer;
+	teleportTimer.Start();
+
 	Vector ptOtherOrigin = pOther->GetAbsOrigin();
 	Vector ptOtherCenter;
 
 	bool bPlayer = pOther->IsPlayer();
 	QAngle qPlayerEyeAngles;
 	CPortal_Player *pOtherAsPlayer;
+	CBaseEntity *pPlayerHeldEntity = NULL; //looked up once, it can't change until the held object handling below
 
 	
 	if( bPlayer )
@@ -944,6 +964,7 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 		//NDebugOverlay::EntityBounds( pOther, 255, 0, 0, 128, 60.0f );
 		pOtherAsPlayer = (CPortal_Player *)pOther;
 		qPlayerEyeAngles = pOtherAsPlayer->pl.v_angle;
+		pPlayerHeldEntity = GetPlayerHeldEntity( pOtherAsPlayer );
 	}
 	else
 	{
@@ -1092,10 +1113,8 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 		float fPlayerFaceDotPortalFace = LocalPortalDataAccess.Placement.vForward.Dot( vPlayerForward );
 		float fPlayerFaceDotPortalUp = LocalPortalDataAccess.Placement.vUp.Dot( vPlayerForward );
 
-		CBaseEntity *pHeldEntity = GetPlayerHeldEntity( pOtherAsPlayer );
-
 		// Sometimes reorienting by pitch is more desirable than by roll depending on the portals' orientations and the relative player facing direction
-		if ( pHeldEntity )	// never pitch reorient while holding an object
+		if ( pPlayerHeldEntity )	// never pitch reorient while holding an object
 		{
 			pOtherAsPlayer->m_bPitchReorientation = false;
 		}
@@ -1229,7 +1248,7 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 	}
 	else if( bPlayer )
 	{
-		CBaseEntity *pHeldEntity = GetPlayerHeldEntity( pOtherAsPlayer );
+		CBaseEntity *pHeldEntity = pPlayerHeldEntity;
 		if( pHeldEntity )
 		{
 			pOtherAsPlayer->ToggleHeldObjectOnOppositeSideOfPortal();
@@ -1249,6 +1268,7 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 				pHeldEntity->Teleport( &vTargetPosition, &qTargetOrientation, 0 );
 
 				FindClosestPassableSpace( pHeldEntity, RemotePortalDataAccess.Placement.vForward );
+				++s_PortalTeleportStats.iHeldObjectFixups;
 			}
 		}
 		
@@ -1311,6 +1331,90 @@ void CProp_Portal::TeleportTouchingEntity( CBaseEntity *pOther )
 	//	NDebugOverlay::EntityBounds( pOther, 0, 255, 0, 128, 60.0f );
 
 	Assert( (bPlayer == false) || (pOtherAsPlayer->m_hPortalEnvironment.Get() == m_hLinkedPortal.Get()) );
+
+	teleportTimer.End();
+	float fMilliseconds = teleportTimer.GetDuration().GetMillisecondsF();
+	++s_PortalTeleportStats.iTeleports;
+	if( bPlayer )
+		++s_PortalTeleportStats.iPlayerTeleports;
+	s_PortalTeleportStats.fTotalMilliseconds += fMilliseconds;
+	s_PortalTeleportStats.fMaxMilliseconds = MAX( s_PortalTeleportStats.fMaxMilliseconds, fMilliseconds );
+}
+
+CON_COMMAND_F( sv_portal_teleport_stats, "Prints and resets the time spent teleporting entities through portals.", FCVAR_CHEAT )
+{
+	const PortalTeleportStats_t &stats = s_PortalTeleportStats;
+	Msg( "Portal teleports: %d (%d players), held object fixups: %d\n", stats.iTeleports, stats.iPlayerTeleports, stats.iHeldObjectFixups );
+	Msg( "  total %.3fms, average %.4fms, worst %.4fms\n", stats.fTotalMilliseconds,
+		( stats.iTeleports != 0 ) ? ( stats.fTotalMilliseconds / stats.iTeleports ) : 0.0f, stats.fMaxMilliseconds );
+
+	memset( &s_PortalTeleportStats, 0, sizeof( s_PortalTeleportStats ) );
+}
+
+//-----------------------------------------------------------------------------
+// Teleport benchmark. Throws a grid of cubes into the first linked portal so
+// sv_portal_teleport_stats has something to measure.
+//-----------------------------------------------------------------------------
+#define PORTAL_TELEPORT_BENCHMARK_MODEL "models/props/metal_box.mdl"
+
+CON_COMMAND_F( sv_portal_teleport_benchmark, "Spawns cubes moving into an active portal and resets sv_portal_teleport_stats. Usage: sv_portal_teleport_benchmark [count]", FCVAR_CHEAT )
+{
+	int iCount = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 16;
+	iCount = clamp( iCount, 1, 64 );
+
+	CProp_Portal *pPortal = NULL;
+	int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
+	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	for( int i = 0; i != iPortalCount; ++i )
+	{
+		if( pPortals[i]->m_bActivated && (pPortals[i]->m_hLinkedPortal.Get() != NULL) )
+		{
+			pPortal = pPortals[i];
+			break;
+		}
+	}
+
+	if( pPortal == NULL )
+	{
+		Msg( "No linked portal to throw cubes into.\n" );
+		return;
+	}
+
+	CBaseEntity::PrecacheModel( PORTAL_TELEPORT_BENCHMARK_MODEL );
+
+	Vector vForward, vRight, vUp;
+	pPortal->GetVectors( &vForward, &vRight, &vUp );
+
+	// Stagger the cubes along the portal normal so they arrive on consecutive frames instead of piling up on the hole
+	int iSpawned = 0;
+	for( int i = 0; i != iCount; ++i )
+	{
+		CBaseEntity *pCube = CreateEntityByName( "prop_physics" );
+		if( pCube == NULL )
+			break;
+
+		Vector vOrigin = pPortal->GetAbsOrigin() + vForward * ( 32.0f + 24.0f * i ) + vRight * ( ( i & 1 ) ? 6.0f : -6.0f );
+		pCube->KeyValue( "model", PORTAL_TELEPORT_BENCHMARK_MODEL );
+		pCube->SetAbsOrigin( vOrigin );
+		pCube->SetAbsAngles( pPortal->GetAbsAngles() );
+		DispatchSpawn( pCube );
+		pCube->Activate();
+
+		IPhysicsObject *pPhysics = pCube->VPhysicsGetObject();
+		if( pPhysics == NULL )
+		{
+			UTIL_Remove( pCube );
+			continue;
+		}
+
+		Vector vVelocity = vForward * -400.0f;
+		pPhysics->EnableGravity( false );
+		pPhysics->SetVelocity( &vVelocity, NULL );
+		++iSpawned;
+	}
+
+	memset( &s_PortalTeleportStats, 0, sizeof( s_PortalTeleportStats ) );
+	Msg( "Threw %d cubes into portal %i, run sv_portal_teleport_stats once they have passed through.\n", iSpawned, pPortal->m_bIsPortal2 ? 2 : 1 );
 }
 
 
@@ -1773,6 +1877,8 @@ void CProp_Portal::UpdatePortalTeleportMatrix( void )
 	m_plane_Origin.dist = m_plane_Origin.normal.Dot( GetAbsOrigin() );
 	m_plane_Origin.signbits = SignbitsForPlane( &m_plane_Origin );
 
+	CProp_Portal_Shared::UpdateSpatialIndex( this );
+
 	Vector vAbsNormal;
 	vAbsNormal.x = fabs(m_plane_Origin.normal.x);
 	vAbsNormal.y = fabs(m_plane_Origin.normal.y);
@@ -77,6 +77,10 @@ PRECACHE_WEAPON_REGISTER(weapon_portalgun);
 extern ConVar sv_portal_placement_debug;
 extern ConVar sv_portal_placement_never_fail;
 
+ConVar sv_portal_placement_preview( "sv_portal_placement_preview", "1", FCVAR_CHEAT, "Reuse the placement computed for the crosshair when a portal is fired at the same spot" );
+ConVar sv_portal_placement_preview_max_age( "sv_portal_placement_preview_max_age", "0.1", FCVAR_CHEAT, "Seconds a crosshair placement stays usable for firing" );
+ConVar sv_portal_placement_preview_tolerance( "sv_portal_placement_preview_tolerance", "0.25", FCVAR_CHEAT, "How far (in units) the shot can land from the crosshair placement and still reuse it" );
+
 
 void CWeaponPortalgun::Spawn( void )
 {
@@ -499,7 +503,68 @@ float CWeaponPortalgun::TraceFirePortal( bool bPortal2, const Vector &vTraceStar
 	VectorAngles( tr.plane.normal, vUp, qFinalAngles );
 
 	vFinalPosition = tr.endpos;
-	return VerifyPortalPlacement( CProp_Portal::FindPortal( m_iPortalLinkageGroupID, bPortal2 ), vFinalPosition, qFinalAngles, iPlacedBy, bTest );
+	return VerifyPortalPlacementWithPreview( bPortal2, tr, vFinalPosition, qFinalAngles, iPlacedBy, bTest );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Think() tests placement for the crosshair 10 times a second. Remember what
+//			it found so a shot landing on the same spot only has to check the result is
+//			still current instead of fitting the portal to the surface again.
+//-----------------------------------------------------------------------------
+float CWeaponPortalgun::VerifyPortalPlacementWithPreview( bool bPortal2, const trace_t &tr, Vector &vFinalPosition, QAngle &qFinalAngles, int iPlacedBy, bool bTest )
+{
+	CProp_Portal *pIgnorePortal = CProp_Portal::FindPortal( m_iPortalLinkageGroupID, bPortal2 );
+	CProp_Portal *pOtherPortal = CProp_Portal::FindPortal( m_iPortalLinkageGroupID, !bPortal2 );
+	bool bOtherPortalActive = ( pOtherPortal && pOtherPortal->m_bActivated );
+
+	PortalPlacementPreview_t &preview = m_PlacementPreview[bPortal2 ? 1 : 0];
+
+	float fPlacementSuccess;
+
+	float fTolerance = sv_portal_placement_preview_tolerance.GetFloat();
+	if ( sv_portal_placement_preview.GetBool() && preview.bValid &&
+		 ( gpGlobals->curtime - preview.fTime ) <= sv_portal_placement_preview_max_age.GetFloat() &&
+		 preview.iPlacedBy == iPlacedBy &&
+		 preview.hSurfaceEntity.Get() == tr.m_pEnt &&
+		 preview.qTraceAngles == qFinalAngles &&
+		 preview.vTraceEndPos.DistToSqr( tr.endpos ) <= fTolerance * fTolerance &&
+		 preview.bOtherPortalActive == bOtherPortalActive &&
+		 ( !bOtherPortalActive || ( preview.vOtherPortalOrigin == pOtherPortal->GetAbsOrigin() && preview.qOtherPortalAngles == pOtherPortal->GetAbsAngles() ) ) )
+	{
+		vFinalPosition = preview.vFinalPosition;
+		qFinalAngles = preview.qFinalAngles;
+		fPlacementSuccess = preview.fPlacementSuccess;
+	}
+	else
+	{
+		// Always evaluate without the test only overlap check so the result is good for firing too
+		fPlacementSuccess = VerifyPortalPlacement( pIgnorePortal, vFinalPosition, qFinalAngles, iPlacedBy, false );
+
+		preview.bValid = true;
+		preview.fTime = gpGlobals->curtime;
+		preview.iPlacedBy = iPlacedBy;
+		preview.vTraceEndPos = tr.endpos;
+		preview.qTraceAngles = qFinalAngles;
+		preview.hSurfaceEntity = tr.m_pEnt;
+		preview.bOtherPortalActive = bOtherPortalActive;
+		if ( bOtherPortalActive )
+		{
+			preview.vOtherPortalOrigin = pOtherPortal->GetAbsOrigin();
+			preview.qOtherPortalAngles = pOtherPortal->GetAbsAngles();
+		}
+		preview.vFinalPosition = vFinalPosition;
+		preview.qFinalAngles = qFinalAngles;
+		preview.fPlacementSuccess = fPlacementSuccess;
+	}
+
+	// VerifyPortalPlacement() only rejects overlapping portals when testing, placing for real fizzles them instead.
+	// A failed placement may report a different failure than a test would, but it's a failure either way.
+	if ( bTest && fPlacementSuccess > PORTAL_ANALOG_SUCCESS_CANT_FIT && IsPortalOverlappingOtherPortals( pIgnorePortal, vFinalPosition, qFinalAngles ) )
+	{
+		return PORTAL_ANALOG_SUCCESS_OVERLAP_LINKED;
+	}
+
+	return fPlacementSuccess;
 }
 
 float CWeaponPortalgun::FirePortal( bool bPortal2, Vector *pVector /*= 0*/, bool bTest /*= false*/ )
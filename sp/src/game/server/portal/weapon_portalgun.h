@@ -16,6 +16,32 @@
 #include "prop_portal.h"
 
 
+//-----------------------------------------------------------------------------
+// Placement evaluated by the periodic aim test in Think(). Firing at the same spot
+// reuses it instead of running the whole surface fit again.
+//-----------------------------------------------------------------------------
+struct PortalPlacementPreview_t
+{
+	PortalPlacementPreview_t( void ) : bValid( false ) {}
+
+	bool	bValid;
+	float	fTime;					// curtime the placement was evaluated
+	int		iPlacedBy;
+
+	// What the placement was evaluated against
+	Vector	vTraceEndPos;
+	QAngle	qTraceAngles;
+	EHANDLE	hSurfaceEntity;
+	bool	bOtherPortalActive;
+	Vector	vOtherPortalOrigin;
+	QAngle	qOtherPortalAngles;
+
+	// Result of VerifyPortalPlacement() without the test only overlap check
+	Vector	vFinalPosition;
+	QAngle	qFinalAngles;
+	float	fPlacementSuccess;
+};
+
 class CWeaponPortalgun : public CBasePortalCombatWeapon
 {
 	DECLARE_DATADESC();
@@ -97,6 +123,7 @@ public:
 
 	float TraceFirePortal( bool bPortal2, const Vector &vTraceStart, const Vector &vDirection, trace_t &tr, Vector &vFinalPosition, QAngle &qFinalAngles, int iPlacedBy, bool bTest = false );
 	float FirePortal( bool bPortal2, Vector *pVector = 0, bool bTest = false );
+	float VerifyPortalPlacementWithPreview( bool bPortal2, const trace_t &tr, Vector &vFinalPosition, QAngle &qFinalAngles, int iPlacedBy, bool bTest );
 
 	CSoundPatch		*m_pMiniGravHoldSound;
 
@@ -135,6 +162,8 @@ public:
 private:
 	CWeaponPortalgun( const CWeaponPortalgun & );
 
+	PortalPlacementPreview_t m_PlacementPreview[2]; // indexed by bPortal2
+
 };
 
 
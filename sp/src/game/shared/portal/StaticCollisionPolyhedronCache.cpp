@@ -9,9 +9,19 @@
 #include "StaticCollisionPolyhedronCache.h"
 #include "engine/IEngineTrace.h"
 #include "edict.h"
+#include "filesystem.h"
+#include "bspfile.h"
+#include "studio.h"
+#include "vstdlib/jobthread.h"
 
 #include "tier0/memdbgon.h"
 
+ConVar portal_polyhedroncache_disk( "portal_polyhedroncache_disk", "1", FCVAR_NONE, "Load/save static collision polyhedrons to a per-map cache file instead of always regenerating them at level load." );
+ConVar portal_polyhedroncache_threaded( "portal_polyhedroncache_threaded", "1", FCVAR_NONE, "Generate static collision polyhedrons on the thread pool at level load." );
+
+#define POLYHEDRONCACHE_FILE_ID			(('C'<<24)+('P'<<16)+('S'<<8)+'P')
+#define POLYHEDRONCACHE_FILE_VERSION	2
+
 
 class CPolyhedron_LumpedMemory : public CPolyhedron //we'll be allocating one big chunk of memory for all our polyhedrons. No individual will own any memory.
 {
@@ -36,8 +46,19 @@ public:
 	}
 };
 
+static inline size_t LumpedPolyhedronSize( unsigned short iVertices, unsigned short iLines, unsigned short iIndices, unsigned short iPolygons )
+{
+	return (sizeof( CPolyhedron_LumpedMemory )) +
+		(sizeof( Vector ) * iVertices) +
+		(sizeof( Polyhedron_IndexedLine_t ) * iLines) +
+		(sizeof( Polyhedron_IndexedLineReference_t ) * iIndices) +
+		(sizeof( Polyhedron_IndexedPolygon_t ) * iPolygons);
+}
+
 static void *s_BrushPolyhedronMemory = NULL;
 static void *s_StaticPropPolyhedronMemory = NULL;
+static size_t s_iBrushPolyhedronMemorySize = 0;
+static size_t s_iStaticPropPolyhedronMemorySize = 0;
 
 CStaticCollisionPolyhedronCache g_StaticCollisionPolyhedronCache;
 
@@ -69,7 +90,19 @@ void CStaticCollisionPolyhedronCache::LevelInitPreEntity( void )
 //		// New map or the last load was a transition, fully update the cache
 //		m_CachedMap.Set( MapName() );
 
-		Update();
+		CRC32_t bspCRC, staticPropCRC;
+		if( portal_polyhedroncache_disk.GetBool() && ComputeCacheKey( &bspCRC, &staticPropCRC ) )
+		{
+			if( !LoadFromDisk( bspCRC, staticPropCRC ) )
+			{
+				Update();
+				SaveToDisk( bspCRC, staticPropCRC );
+			}
+		}
+		else
+		{
+			Update();
+		}
 //	}
 //	else
 //	{
@@ -106,6 +139,7 @@ void CStaticCollisionPolyhedronCache::Clear( void )
 			delete []s_BrushPolyhedronMemory;
 			s_BrushPolyhedronMemory = NULL;
 		}
+		s_iBrushPolyhedronMemorySize = 0;
 	}
 
 	//Static props
@@ -117,334 +151,700 @@ void CStaticCollisionPolyhedronCache::Clear( void )
 			delete []s_StaticPropPolyhedronMemory;
 			s_StaticPropPolyhedronMemory = NULL;
 		}
+		s_iStaticPropPolyhedronMemorySize = 0;
 	}
 }
 
-void CStaticCollisionPolyhedronCache::Update( void )
+//-----------------------------------------------------------------------------
+// Polyhedron generation is independent per brush and per static prop convex, so Update() gathers
+// the raw inputs on the main thread, farms out contiguous ranges of them to the thread pool and
+// then consolidates every job's workspace into one allocation in the original order.
+//-----------------------------------------------------------------------------
+#define POLYHEDRONCACHE_WORKSPACE_SIZE		(1024 * 1024) //1MB. Fairly arbitrary size for a workspace. Brushes usually use 1-3MB in the end. Static props usually use about half as much as brushes.
+#define POLYHEDRONCACHE_MAX_JOBS			64
+
+class CPolyhedronWorkSpace
 {
-	Clear();
+public:
+	CPolyhedronWorkSpace( void ) : m_pCurrent( NULL ), m_iRoomLeft( 0 ) { }
+	~CPolyhedronWorkSpace( void ) { Free(); }
 
-	//There's no efficient way to know exactly how much memory we'll need to cache off all these polyhedrons.
-	//So we're going to allocated temporary workspaces as we need them and consolidate into one allocation at the end.
-	const size_t workSpaceSize = 1024 * 1024; //1MB. Fairly arbitrary size for a workspace. Brushes usually use 1-3MB in the end. Static props usually use about half as much as brushes.
-
-	uint8 *workSpaceAllocations[256];
-	size_t usedSpaceInWorkspace[256];
-	unsigned int workSpacesAllocated = 0;
-	uint8 *pCurrentWorkSpace = new uint8 [workSpaceSize];
-	size_t roomLeftInWorkSpace = workSpaceSize;
-	workSpaceAllocations[workSpacesAllocated] = pCurrentWorkSpace;
-	usedSpaceInWorkspace[workSpacesAllocated] = 0;
-	++workSpacesAllocated;
-	
+	CPolyhedron *Store( const CPolyhedron *pTempPolyhedron )
+	{
+		size_t memRequired = LumpedPolyhedronSize( pTempPolyhedron->iVertexCount, pTempPolyhedron->iLineCount, pTempPolyhedron->iIndexCount, pTempPolyhedron->iPolygonCount );
 
-	//brushes
+		if( m_iRoomLeft < memRequired )
+		{
+			size_t iChunkSize = MAX( memRequired, (size_t)POLYHEDRONCACHE_WORKSPACE_SIZE );
+			m_pCurrent = new uint8 [iChunkSize];
+			m_iRoomLeft = iChunkSize;
+			m_Chunks.AddToTail( m_pCurrent );
+		}
+
+		CPolyhedron *pWorkSpacePolyhedron = CPolyhedron_LumpedMemory::AllocateAt( m_pCurrent, 
+																					pTempPolyhedron->iVertexCount,
+																					pTempPolyhedron->iLineCount,
+																					pTempPolyhedron->iIndexCount,
+																					pTempPolyhedron->iPolygonCount );
+
+		m_pCurrent += memRequired;
+		m_iRoomLeft -= memRequired;
+
+		memcpy( pWorkSpacePolyhedron->pVertices, pTempPolyhedron->pVertices, pTempPolyhedron->iVertexCount * sizeof( Vector ) );
+		memcpy( pWorkSpacePolyhedron->pLines, pTempPolyhedron->pLines, pTempPolyhedron->iLineCount * sizeof( Polyhedron_IndexedLine_t ) );
+		memcpy( pWorkSpacePolyhedron->pIndices, pTempPolyhedron->pIndices, pTempPolyhedron->iIndexCount * sizeof( Polyhedron_IndexedLineReference_t ) );
+		memcpy( pWorkSpacePolyhedron->pPolygons, pTempPolyhedron->pPolygons, pTempPolyhedron->iPolygonCount * sizeof( Polyhedron_IndexedPolygon_t ) );
+
+		return pWorkSpacePolyhedron;
+	}
+
+	void Free( void )
+	{
+		for( int i = 0; i != m_Chunks.Count(); ++i )
+		{
+			delete []m_Chunks[i];
+		}
+		m_Chunks.RemoveAll();
+		m_pCurrent = NULL;
+		m_iRoomLeft = 0;
+	}
+
+private:
+	CUtlVector<uint8 *> m_Chunks;
+	uint8 *m_pCurrent;
+	size_t m_iRoomLeft;
+};
+
+struct BrushPolyhedronSource_t
+{
+	int iFirstPlane; //index into the shared plane array, in floats / 4
+	int iPlaneCount;
+};
+
+struct StaticPropConvexSource_t
+{
+	CPhysConvex *pConvex;
+	int iTransform; //index into the shared transform array, one per static prop
+};
+
+struct PolyhedronBuildJob_t
+{
+	int iFirstSource;
+	int iSourceCount;
+	CPolyhedronWorkSpace WorkSpace;
+	CUtlVector<CPolyhedron *> Results; //one per source, NULL for failed generation. Points into WorkSpace
+};
+
+static const float *s_pBuildPlanes = NULL;
+static const BrushPolyhedronSource_t *s_pBuildBrushes = NULL;
+static const StaticPropConvexSource_t *s_pBuildConvexes = NULL;
+static const VMatrix *s_pBuildTransforms = NULL;
+
+static void BuildBrushPolyhedrons( PolyhedronBuildJob_t &job )
+{
+	job.Results.EnsureCapacity( job.iSourceCount );
+
+	for( int i = job.iFirstSource; i != job.iFirstSource + job.iSourceCount; ++i )
 	{
-		int iBrush = 0;
-		CUtlVector<Vector4D> Planes;
+		const BrushPolyhedronSource_t &brush = s_pBuildBrushes[i];
 
-		float fStackPlanes[4 * 400]; //400 is a crapload of planes in my opinion
+		//temporary memory is a single shared polyhedron, no good across threads
+		CPolyhedron *pTempPolyhedron = GeneratePolyhedronFromPlanes( s_pBuildPlanes + (brush.iFirstPlane * 4), brush.iPlaneCount, 0.01f, false );
 
-		while( enginetrace->GetBrushInfo( iBrush, &Planes, NULL ) )
+		if( pTempPolyhedron )
+		{
+			job.Results.AddToTail( job.WorkSpace.Store( pTempPolyhedron ) );
+			pTempPolyhedron->Release();
+		}
+		else
 		{
-			int iPlaneCount = Planes.Count();
-			AssertMsg( iPlaneCount != 0, "A brush with no planes???????" );
+			job.Results.AddToTail( NULL );
+		}
+	}
+}
 
-			const Vector4D *pReturnedPlanes = Planes.Base();
+static void BuildStaticPropPolyhedrons( PolyhedronBuildJob_t &job )
+{
+	job.Results.EnsureCapacity( job.iSourceCount );
 
-			CPolyhedron *pTempPolyhedron;
+	for( int i = job.iFirstSource; i != job.iFirstSource + job.iSourceCount; ++i )
+	{
+		const StaticPropConvexSource_t &convex = s_pBuildConvexes[i];
+		const VMatrix &matToWorldPosition = s_pBuildTransforms[convex.iTransform];
 
-			if( iPlaneCount > 400 )
-			{
-				// o_O, we'll have to get more memory to transform this brush
-				float *pNonstackPlanes = new float [4 * iPlaneCount];
+		CPolyhedron *pTempPolyhedron = physcollision->PolyhedronFromConvex( convex.pConvex, false );
+		if( pTempPolyhedron == NULL )
+		{
+			job.Results.AddToTail( NULL );
+			continue;
+		}
 
-				for( int i = 0; i != iPlaneCount; ++i )
-				{
-					pNonstackPlanes[(i * 4) + 0] = pReturnedPlanes[i].x;
-					pNonstackPlanes[(i * 4) + 1] = pReturnedPlanes[i].y;
-					pNonstackPlanes[(i * 4) + 2] = pReturnedPlanes[i].z;
-					pNonstackPlanes[(i * 4) + 3] = pReturnedPlanes[i].w;
-				}
+		for( int iPointCounter = 0; iPointCounter != pTempPolyhedron->iVertexCount; ++iPointCounter )
+			pTempPolyhedron->pVertices[iPointCounter] = matToWorldPosition * pTempPolyhedron->pVertices[iPointCounter];
 
-				pTempPolyhedron = GeneratePolyhedronFromPlanes( pNonstackPlanes, iPlaneCount, 0.01f, true );
+		for( int iPolyCounter = 0; iPolyCounter != pTempPolyhedron->iPolygonCount; ++iPolyCounter )
+			pTempPolyhedron->pPolygons[iPolyCounter].polyNormal = matToWorldPosition.ApplyRotation( pTempPolyhedron->pPolygons[iPolyCounter].polyNormal );
 
-				delete []pNonstackPlanes;
-			}
-			else
+		job.Results.AddToTail( job.WorkSpace.Store( pTempPolyhedron ) );
+
+#ifdef _DEBUG
+		CPhysConvex *pConvex = physcollision->ConvexFromConvexPolyhedron( *pTempPolyhedron );
+		AssertMsg( pConvex != NULL, "Conversion from Convex to Polyhedron was unreversable" );
+		if( pConvex )
+		{
+			physcollision->ConvexFree( pConvex );
+		}
+#endif
+
+		pTempPolyhedron->Release();
+	}
+}
+
+//split iSourceCount sources into jobs of roughly equal cost. pCosts can be NULL for uniform cost
+static int PartitionPolyhedronBuildJobs( PolyhedronBuildJob_t *pJobs, int iSourceCount, const int *pCosts )
+{
+	if( iSourceCount == 0 )
+		return 0;
+
+	int iDesiredJobs = 1;
+	if( portal_polyhedroncache_threaded.GetBool() && g_pThreadPool )
+		iDesiredJobs = MIN( (g_pThreadPool->NumThreads() + 1) * 4, POLYHEDRONCACHE_MAX_JOBS );
+	iDesiredJobs = MIN( iDesiredJobs, iSourceCount );
+
+	int64 iTotalCost = 0;
+	for( int i = 0; i != iSourceCount; ++i )
+		iTotalCost += pCosts ? pCosts[i] : 1;
+
+	int iJobCount = 0;
+	int iSource = 0;
+	int64 iCostSoFar = 0;
+	while( iSource != iSourceCount )
+	{
+		PolyhedronBuildJob_t &job = pJobs[iJobCount++];
+		job.iFirstSource = iSource;
+
+		int64 iCostLimit = (iJobCount == iDesiredJobs) ? iTotalCost : (iTotalCost * iJobCount) / iDesiredJobs;
+		do
+		{
+			iCostSoFar += pCosts ? pCosts[iSource] : 1;
+			++iSource;
+		} while( (iSource != iSourceCount) && (iCostSoFar < iCostLimit) );
+
+		job.iSourceCount = iSource - job.iFirstSource;
+	}
+
+	return iJobCount;
+}
+
+//copy polyhedrons from job workspaces into one allocation, updating the pointers in place
+static void ConsolidatePolyhedrons( CUtlVector<CPolyhedron *> &Polyhedrons, void **ppMemory, size_t *pMemorySize )
+{
+	size_t totalMemoryNeeded = 0;
+	int iCount = Polyhedrons.Count();
+	for( int i = 0; i != iCount; ++i )
+	{
+		CPolyhedron *pSource = Polyhedrons[i];
+		if( pSource )
+			totalMemoryNeeded += LumpedPolyhedronSize( pSource->iVertexCount, pSource->iLineCount, pSource->iIndexCount, pSource->iPolygonCount );
+	}
+
+	if( totalMemoryNeeded == 0 )
+		return;
+
+	uint8 *pFinalDest = new uint8 [totalMemoryNeeded];
+	*ppMemory = pFinalDest;
+	*pMemorySize = totalMemoryNeeded;
+
+	for( int i = 0; i != iCount; ++i )
+	{
+		CPolyhedron_LumpedMemory *pSource = (CPolyhedron_LumpedMemory *)Polyhedrons[i];
+
+		if( pSource == NULL )
+			continue;
+
+		size_t memRequired = LumpedPolyhedronSize( pSource->iVertexCount, pSource->iLineCount, pSource->iIndexCount, pSource->iPolygonCount );
+
+		CPolyhedron_LumpedMemory *pDest = (CPolyhedron_LumpedMemory *)pFinalDest;
+		Polyhedrons[i] = pDest;
+		pFinalDest += memRequired;
+
+		intp memoryOffset = ((uint8 *)pDest) - ((uint8 *)pSource);
+
+		memcpy( pDest, pSource, memRequired );
+		//move all the pointers to their new location.
+		pDest->pVertices = (Vector *)(((uint8 *)(pDest->pVertices)) + memoryOffset);
+		pDest->pLines = (Polyhedron_IndexedLine_t *)(((uint8 *)(pDest->pLines)) + memoryOffset);
+		pDest->pIndices = (Polyhedron_IndexedLineReference_t *)(((uint8 *)(pDest->pIndices)) + memoryOffset);
+		pDest->pPolygons = (Polyhedron_IndexedPolygon_t *)(((uint8 *)(pDest->pPolygons)) + memoryOffset);
+	}
+}
+
+void CStaticCollisionPolyhedronCache::Update( void )
+{
+	Clear();
+
+	int iMaxParallel = portal_polyhedroncache_threaded.GetBool() ? INT_MAX : 0;
+	PolyhedronBuildJob_t *pJobs = new PolyhedronBuildJob_t [POLYHEDRONCACHE_MAX_JOBS];
+
+	//brushes
+	{
+		//enginetrace isn't safe to call from the pool, gather every brush's planes up front
+		CUtlVector<float> AllPlanes;
+		CUtlVector<BrushPolyhedronSource_t> Brushes;
+		CUtlVector<int> BrushCosts;
+		{
+			int iBrush = 0;
+			CUtlVector<Vector4D> Planes;
+
+			while( enginetrace->GetBrushInfo( iBrush, &Planes, NULL ) )
 			{
+				int iPlaneCount = Planes.Count();
+				AssertMsg( iPlaneCount != 0, "A brush with no planes???????" );
+
+				BrushPolyhedronSource_t brush;
+				brush.iFirstPlane = AllPlanes.Count() / 4;
+				brush.iPlaneCount = iPlaneCount;
+				Brushes.AddToTail( brush );
+				BrushCosts.AddToTail( iPlaneCount * iPlaneCount ); //every plane clips the work polyhedron built by the previous ones
+
+				float *pPlanes = AllPlanes.AddMultipleToTail( iPlaneCount * 4 );
+				const Vector4D *pReturnedPlanes = Planes.Base();
 				for( int i = 0; i != iPlaneCount; ++i )
 				{
-					fStackPlanes[(i * 4) + 0] = pReturnedPlanes[i].x;
-					fStackPlanes[(i * 4) + 1] = pReturnedPlanes[i].y;
-					fStackPlanes[(i * 4) + 2] = pReturnedPlanes[i].z;
-					fStackPlanes[(i * 4) + 3] = pReturnedPlanes[i].w;
+					pPlanes[(i * 4) + 0] = pReturnedPlanes[i].x;
+					pPlanes[(i * 4) + 1] = pReturnedPlanes[i].y;
+					pPlanes[(i * 4) + 2] = pReturnedPlanes[i].z;
+					pPlanes[(i * 4) + 3] = pReturnedPlanes[i].w;
 				}
 
-				pTempPolyhedron = GeneratePolyhedronFromPlanes( fStackPlanes, iPlaneCount, 0.01f, true );
+				++iBrush;
 			}
+		}
 
-			if( pTempPolyhedron )
-			{
-				size_t memRequired = (sizeof( CPolyhedron_LumpedMemory )) +
-					(sizeof( Vector ) * pTempPolyhedron->iVertexCount) +
-					(sizeof( Polyhedron_IndexedLine_t ) * pTempPolyhedron->iLineCount) +
-					(sizeof( Polyhedron_IndexedLineReference_t ) * pTempPolyhedron->iIndexCount) +
-					(sizeof( Polyhedron_IndexedPolygon_t ) * pTempPolyhedron->iPolygonCount);
+		s_pBuildPlanes = AllPlanes.Base();
+		s_pBuildBrushes = Brushes.Base();
 
-				Assert( memRequired < workSpaceSize );
+		int iJobCount = PartitionPolyhedronBuildJobs( pJobs, Brushes.Count(), BrushCosts.Base() );
+		ParallelProcess( "CStaticCollisionPolyhedronCache::BuildBrushPolyhedrons", pJobs, iJobCount, BuildBrushPolyhedrons, NULL, NULL, iMaxParallel );
 
-				if( roomLeftInWorkSpace < memRequired )
-				{
-					usedSpaceInWorkspace[workSpacesAllocated - 1] = workSpaceSize - roomLeftInWorkSpace;
+		s_pBuildPlanes = NULL;
+		s_pBuildBrushes = NULL;
 
-					pCurrentWorkSpace = new uint8 [workSpaceSize];
-					roomLeftInWorkSpace = workSpaceSize;
-					workSpaceAllocations[workSpacesAllocated] = pCurrentWorkSpace;
-					usedSpaceInWorkspace[workSpacesAllocated] = 0;
-					++workSpacesAllocated;
-				}
+		m_BrushPolyhedrons.EnsureCapacity( Brushes.Count() );
+		for( int i = 0; i != iJobCount; ++i )
+		{
+			m_BrushPolyhedrons.AddVectorToTail( pJobs[i].Results );
+		}
+
+		ConsolidatePolyhedrons( m_BrushPolyhedrons, &s_BrushPolyhedronMemory, &s_iBrushPolyhedronMemorySize );
+
+		if( s_BrushPolyhedronMemory != NULL )
+			DevMsg( 2, "CStaticCollisionPolyhedronCache: Used %.2f KB to cache %d brush polyhedrons.\n", ((float)s_iBrushPolyhedronMemorySize) / 1024.0f, m_BrushPolyhedrons.Count() );
 
-				CPolyhedron *pWorkSpacePolyhedron = CPolyhedron_LumpedMemory::AllocateAt( pCurrentWorkSpace, 
-																							pTempPolyhedron->iVertexCount,
-																							pTempPolyhedron->iLineCount,
-																							pTempPolyhedron->iIndexCount,
-																							pTempPolyhedron->iPolygonCount );
+		for( int i = 0; i != iJobCount; ++i )
+		{
+			pJobs[i].WorkSpace.Free();
+			pJobs[i].Results.RemoveAll();
+		}
+	}
 
-				pCurrentWorkSpace += memRequired;
-				roomLeftInWorkSpace -= memRequired;
+	//static props
+	{
+		CUtlVector<ICollideable *> StaticPropCollideables;
+		staticpropmgr->GetAllStaticProps( &StaticPropCollideables );
 
-				memcpy( pWorkSpacePolyhedron->pVertices, pTempPolyhedron->pVertices, pTempPolyhedron->iVertexCount * sizeof( Vector ) );
-				memcpy( pWorkSpacePolyhedron->pLines, pTempPolyhedron->pLines, pTempPolyhedron->iLineCount * sizeof( Polyhedron_IndexedLine_t ) );
-				memcpy( pWorkSpacePolyhedron->pIndices, pTempPolyhedron->pIndices, pTempPolyhedron->iIndexCount * sizeof( Polyhedron_IndexedLineReference_t ) );
-				memcpy( pWorkSpacePolyhedron->pPolygons, pTempPolyhedron->pPolygons, pTempPolyhedron->iPolygonCount * sizeof( Polyhedron_IndexedPolygon_t ) );
+		//gather convexes on the main thread, modelinfo and the vcollide cache aren't thread safe
+		CUtlVector<VMatrix> Transforms;
+		CUtlVector<StaticPropConvexSource_t> Convexes;
+		CUtlVector<int> PropFirstConvex;
+		CUtlVector<bool> PropHasCollide;
+		Transforms.SetCount( StaticPropCollideables.Count() );
+		PropHasCollide.SetCount( StaticPropCollideables.Count() );
+		PropFirstConvex.SetCount( StaticPropCollideables.Count() + 1 );
 
-				m_BrushPolyhedrons.AddToTail( pWorkSpacePolyhedron );
+		for( int iStaticPropIndex = 0; iStaticPropIndex != StaticPropCollideables.Count(); ++iStaticPropIndex )
+		{
+			ICollideable *pProp = StaticPropCollideables[iStaticPropIndex];
+			vcollide_t *pCollide = modelinfo->GetVCollide( pProp->GetCollisionModel() );
+			PropFirstConvex[iStaticPropIndex] = Convexes.Count();
+			PropHasCollide[iStaticPropIndex] = (pCollide != NULL);
 
-				pTempPolyhedron->Release();
-			}
-			else
+			if( pCollide != NULL )
 			{
-				m_BrushPolyhedrons.AddToTail( NULL );
+				Transforms[iStaticPropIndex] = pProp->CollisionToWorldTransform();
+
+				for( int i = 0; i != pCollide->solidCount; ++i )
+				{
+					CPhysConvex *ConvexesArray[1024];
+					int iConvexes = physcollision->GetConvexesUsedInCollideable( pCollide->solids[i], ConvexesArray, 1024 );
+
+					for( int j = 0; j != iConvexes; ++j )
+					{
+						StaticPropConvexSource_t convex;
+						convex.pConvex = ConvexesArray[j];
+						convex.iTransform = iStaticPropIndex;
+						Convexes.AddToTail( convex );
+					}
+				}
 			}
+		}
+		PropFirstConvex[StaticPropCollideables.Count()] = Convexes.Count();
+
+		s_pBuildConvexes = Convexes.Base();
+		s_pBuildTransforms = Transforms.Base();
+
+		int iJobCount = PartitionPolyhedronBuildJobs( pJobs, Convexes.Count(), NULL );
+		ParallelProcess( "CStaticCollisionPolyhedronCache::BuildStaticPropPolyhedrons", pJobs, iJobCount, BuildStaticPropPolyhedrons, NULL, NULL, iMaxParallel );
+
+		s_pBuildConvexes = NULL;
+		s_pBuildTransforms = NULL;
 
-			++iBrush;
+		//flatten job results back into per-convex order
+		CUtlVector<CPolyhedron *> ConvexPolyhedrons;
+		ConvexPolyhedrons.EnsureCapacity( Convexes.Count() );
+		for( int i = 0; i != iJobCount; ++i )
+		{
+			ConvexPolyhedrons.AddVectorToTail( pJobs[i].Results );
 		}
 
-		usedSpaceInWorkspace[workSpacesAllocated - 1] = workSpaceSize - roomLeftInWorkSpace;
-		
-		if( usedSpaceInWorkspace[0] != 0 ) //At least a little bit of memory was used.
+		for( int iStaticPropIndex = 0; iStaticPropIndex != StaticPropCollideables.Count(); ++iStaticPropIndex )
 		{
-			//consolidate workspaces into a single memory chunk
-			size_t totalMemoryNeeded = 0;
-			for( unsigned int i = 0; i != workSpacesAllocated; ++i )
-			{
-				totalMemoryNeeded += usedSpaceInWorkspace[i];
-			}
+			if( !PropHasCollide[iStaticPropIndex] )
+				continue;
 
-			uint8 *pFinalDest = new uint8 [totalMemoryNeeded];
-			s_BrushPolyhedronMemory = pFinalDest;
+			ICollideable *pProp = StaticPropCollideables[iStaticPropIndex];
 
-			DevMsg( 2, "CStaticCollisionPolyhedronCache: Used %.2f KB to cache %d brush polyhedrons.\n", ((float)totalMemoryNeeded) / 1024.0f, m_BrushPolyhedrons.Count() );
+			StaticPropPolyhedronCacheInfo_t cacheInfo;
+			cacheInfo.iStartIndex = m_StaticPropPolyhedrons.Count();
 
-			int iCount = m_BrushPolyhedrons.Count();
-			for( int i = 0; i != iCount; ++i )
+			for( int i = PropFirstConvex[iStaticPropIndex]; i != PropFirstConvex[iStaticPropIndex + 1]; ++i )
 			{
-				CPolyhedron_LumpedMemory *pSource = (CPolyhedron_LumpedMemory *)m_BrushPolyhedrons[i];
-
-				if( pSource == NULL )
-					continue;
-				
-				size_t memRequired = (sizeof( CPolyhedron_LumpedMemory )) +
-										(sizeof( Vector ) * pSource->iVertexCount) +
-										(sizeof( Polyhedron_IndexedLine_t ) * pSource->iLineCount) +
-										(sizeof( Polyhedron_IndexedLineReference_t ) * pSource->iIndexCount) +
-										(sizeof( Polyhedron_IndexedPolygon_t ) * pSource->iPolygonCount);
-
-				CPolyhedron_LumpedMemory *pDest = (CPolyhedron_LumpedMemory *)pFinalDest;
-				m_BrushPolyhedrons[i] = pDest;
-				pFinalDest += memRequired;
-
-				int memoryOffset = ((uint8 *)pDest) - ((uint8 *)pSource);
-
-				memcpy( pDest, pSource, memRequired );
-				//move all the pointers to their new location.
-				pDest->pVertices = (Vector *)(((uint8 *)(pDest->pVertices)) + memoryOffset);
-				pDest->pLines = (Polyhedron_IndexedLine_t *)(((uint8 *)(pDest->pLines)) + memoryOffset);
-				pDest->pIndices = (Polyhedron_IndexedLineReference_t *)(((uint8 *)(pDest->pIndices)) + memoryOffset);
-				pDest->pPolygons = (Polyhedron_IndexedPolygon_t *)(((uint8 *)(pDest->pPolygons)) + memoryOffset);
+				if( ConvexPolyhedrons[i] )
+					m_StaticPropPolyhedrons.AddToTail( ConvexPolyhedrons[i] );
 			}
+
+			cacheInfo.iNumPolyhedrons = m_StaticPropPolyhedrons.Count() - cacheInfo.iStartIndex;
+			cacheInfo.iStaticPropIndex = iStaticPropIndex;
+			Assert( staticpropmgr->GetStaticPropByIndex( iStaticPropIndex ) == pProp );
+
+			m_CollideableIndicesMap.InsertOrReplace( pProp, cacheInfo );
 		}
+
+		ConsolidatePolyhedrons( m_StaticPropPolyhedrons, &s_StaticPropPolyhedronMemory, &s_iStaticPropPolyhedronMemorySize );
+
+		if( s_StaticPropPolyhedronMemory != NULL )
+			DevMsg( 2, "CStaticCollisionPolyhedronCache: Used %.2f KB to cache %d static prop polyhedrons.\n", ((float)s_iStaticPropPolyhedronMemorySize) / 1024.0f, m_StaticPropPolyhedrons.Count() );
 	}
 
-	unsigned int iBrushWorkSpaces = workSpacesAllocated;
-	workSpacesAllocated = 1;
-	pCurrentWorkSpace = workSpaceAllocations[0];
-	usedSpaceInWorkspace[0] = 0;
-	roomLeftInWorkSpace = workSpaceSize;
+	delete []pJobs;
+}
 
-	//static props
+
+
+//-----------------------------------------------------------------------------
+// On-disk cache
+//
+// File layout, all written by the same build that reads it back:
+//		PolyhedronCacheFileHeader_t
+//		int[iBrushCount]					offset of each brush polyhedron in the brush lump, -1 for brushes that failed to generate
+//		int[iStaticPropPolyhedronCount]		offset of each static prop polyhedron in the static prop lump
+//		StaticPropPolyhedronCacheInfo_t[iStaticPropInfoCount]
+//		brush lump, an exact image of s_BrushPolyhedronMemory
+//		static prop lump, an exact image of s_StaticPropPolyhedronMemory
+//
+// The lumps are read straight into their final allocations. Only the vtable and the internal
+// array pointers of each CPolyhedron_LumpedMemory need to be fixed up after the read.
+//-----------------------------------------------------------------------------
+struct PolyhedronCacheFileHeader_t
+{
+	int			id;
+	int			iVersion;
+	int			iLumpedPolyhedronSize; //sizeof( CPolyhedron_LumpedMemory ), catches pointer size/layout changes
+	CRC32_t		bspCRC;
+	CRC32_t		staticPropCRC;
+	int			iBrushCount;
+	int			iStaticPropPolyhedronCount;
+	int			iStaticPropInfoCount;
+	unsigned int iBrushMemorySize;
+	unsigned int iStaticPropMemorySize;
+};
+
+static void GetPolyhedronCacheMapName( char *pOut, int iOutSize )
+{
+	const char *pMapName = IGameSystem::MapName();
+	if( pMapName == NULL )
+	{
+		pOut[0] = '\0';
+		return;
+	}
+
+	if( Q_strnicmp( pMapName, "maps/", 5 ) == 0 || Q_strnicmp( pMapName, "maps\\", 5 ) == 0 )
+		pMapName += 5;
+
+	Q_StripExtension( pMapName, pOut, iOutSize );
+}
+
+static CPolyhedron *RelocateLumpedPolyhedron( uint8 *pLump, size_t iLumpSize, int iOffset )
+{
+	if( (iOffset < 0) || ((size_t)iOffset + sizeof( CPolyhedron_LumpedMemory ) > iLumpSize) )
+		return NULL;
+
+	//the stored object still holds valid counts, everything else in the header is stale
+	const CPolyhedron *pStored = (const CPolyhedron *)(pLump + iOffset);
+	unsigned short iVertices = pStored->iVertexCount;
+	unsigned short iLines = pStored->iLineCount;
+	unsigned short iIndices = pStored->iIndexCount;
+	unsigned short iPolygons = pStored->iPolygonCount;
+
+	if( (size_t)iOffset + LumpedPolyhedronSize( iVertices, iLines, iIndices, iPolygons ) > iLumpSize )
+		return NULL;
+
+	return CPolyhedron_LumpedMemory::AllocateAt( pLump + iOffset, iVertices, iLines, iIndices, iPolygons );
+}
+
+bool CStaticCollisionPolyhedronCache::ComputeCacheKey( CRC32_t *pBSPCRC, CRC32_t *pStaticPropCRC )
+{
+	char szMapName[MAX_PATH];
+	GetPolyhedronCacheMapName( szMapName, sizeof( szMapName ) );
+	if( szMapName[0] == '\0' )
+		return false;
+
+	char szBSPName[MAX_PATH];
+	Q_snprintf( szBSPName, sizeof( szBSPName ), "maps/%s.bsp", szMapName );
+
+	FileHandle_t hBSP = filesystem->Open( szBSPName, "rb", "GAME" );
+	if( hBSP == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	//the header holds every lump's offset and size plus the map revision, so with the file size and time it changes whenever the map is recompiled.
+	//Reading the whole bsp to CRC it costs more than the cache saves on big maps.
+	dheader_t bspHeader;
+	bool bReadHeader = (filesystem->Read( &bspHeader, sizeof( bspHeader ), hBSP ) == sizeof( bspHeader ));
+	unsigned int iBSPSize = filesystem->Size( hBSP );
+	filesystem->Close( hBSP );
+	if( !bReadHeader )
+		return false;
+
+	long iBSPFileTime = filesystem->GetFileTime( szBSPName, "GAME" );
+
+	CRC32_Init( pBSPCRC );
+	CRC32_ProcessBuffer( pBSPCRC, &bspHeader, sizeof( bspHeader ) );
+	CRC32_ProcessBuffer( pBSPCRC, &iBSPSize, sizeof( iBSPSize ) );
+	CRC32_ProcessBuffer( pBSPCRC, &iBSPFileTime, sizeof( iBSPFileTime ) );
+	CRC32_Final( pBSPCRC );
+
+	//static props are part of the bsp, but their collision comes from the models which can change independently
+	CRC32_Init( pStaticPropCRC );
 	{
 		CUtlVector<ICollideable *> StaticPropCollideables;
 		staticpropmgr->GetAllStaticProps( &StaticPropCollideables );
 
-		if( StaticPropCollideables.Count() != 0 )
-		{
-			ICollideable **pCollideables = StaticPropCollideables.Base();
-			ICollideable **pStop = pCollideables + StaticPropCollideables.Count();
+		int iCount = StaticPropCollideables.Count();
+		CRC32_ProcessBuffer( pStaticPropCRC, &iCount, sizeof( iCount ) );
 
-			int iStaticPropIndex = 0;
-			do
+		for( int i = 0; i != iCount; ++i )
+		{
+			ICollideable *pProp = StaticPropCollideables[i];
+			const model_t *pModel = pProp->GetCollisionModel();
+			const char *pModelName = pModel ? modelinfo->GetModelName( pModel ) : "";
+			CRC32_ProcessBuffer( pStaticPropCRC, pModelName, Q_strlen( pModelName ) );
+
+			//the .phy has to carry the same checksum as the model it was compiled with, so recompiling the model changes this
+			studiohdr_t *pStudioHdr = pModel ? modelinfo->GetStudiomodel( pModel ) : NULL;
+			int iModelChecksum = pStudioHdr ? pStudioHdr->checksum : 0;
+			CRC32_ProcessBuffer( pStaticPropCRC, &iModelChecksum, sizeof( iModelChecksum ) );
+
+			vcollide_t *pCollide = pModel ? modelinfo->GetVCollide( pModel ) : NULL;
+			int iSolidCount = pCollide ? pCollide->solidCount : 0;
+			CRC32_ProcessBuffer( pStaticPropCRC, &iSolidCount, sizeof( iSolidCount ) );
+			for( int j = 0; j != iSolidCount; ++j )
 			{
-				ICollideable *pProp = *pCollideables;
-				vcollide_t *pCollide = modelinfo->GetVCollide( pProp->GetCollisionModel() );
-				StaticPropPolyhedronCacheInfo_t cacheInfo;
-				cacheInfo.iStartIndex = m_StaticPropPolyhedrons.Count();
+				int iSolidSize = physcollision->CollideSize( pCollide->solids[j] );
+				CRC32_ProcessBuffer( pStaticPropCRC, &iSolidSize, sizeof( iSolidSize ) );
+			}
 
-				if( pCollide != NULL )
-				{
-					VMatrix matToWorldPosition = pProp->CollisionToWorldTransform();
+			const matrix3x4_t &matToWorld = pProp->CollisionToWorldTransform();
+			CRC32_ProcessBuffer( pStaticPropCRC, &matToWorld, sizeof( matrix3x4_t ) );
+		}
+	}
+	CRC32_Final( pStaticPropCRC );
 
-					for( int i = 0; i != pCollide->solidCount; ++i )
-					{
-						CPhysConvex *ConvexesArray[1024];
-						int iConvexes = physcollision->GetConvexesUsedInCollideable( pCollide->solids[i], ConvexesArray, 1024 );
-
-						for( int j = 0; j != iConvexes; ++j )
-						{
-							CPolyhedron *pTempPolyhedron = physcollision->PolyhedronFromConvex( ConvexesArray[j], true );
-							if( pTempPolyhedron )
-							{
-								for( int iPointCounter = 0; iPointCounter != pTempPolyhedron->iVertexCount; ++iPointCounter )
-									pTempPolyhedron->pVertices[iPointCounter] = matToWorldPosition * pTempPolyhedron->pVertices[iPointCounter];
-
-								for( int iPolyCounter = 0; iPolyCounter != pTempPolyhedron->iPolygonCount; ++iPolyCounter )
-									pTempPolyhedron->pPolygons[iPolyCounter].polyNormal = matToWorldPosition.ApplyRotation( pTempPolyhedron->pPolygons[iPolyCounter].polyNormal );
-
-								
-								size_t memRequired = (sizeof( CPolyhedron_LumpedMemory )) +
-									(sizeof( Vector ) * pTempPolyhedron->iVertexCount) +
-									(sizeof( Polyhedron_IndexedLine_t ) * pTempPolyhedron->iLineCount) +
-									(sizeof( Polyhedron_IndexedLineReference_t ) * pTempPolyhedron->iIndexCount) +
-									(sizeof( Polyhedron_IndexedPolygon_t ) * pTempPolyhedron->iPolygonCount);
-
-								Assert( memRequired < workSpaceSize );
-
-								if( roomLeftInWorkSpace < memRequired )
-								{
-									usedSpaceInWorkspace[workSpacesAllocated - 1] = workSpaceSize - roomLeftInWorkSpace;
-									
-									if( workSpacesAllocated < iBrushWorkSpaces )
-									{
-										//re-use a workspace already allocated during brush polyhedron conversion
-										pCurrentWorkSpace = workSpaceAllocations[workSpacesAllocated];
-										usedSpaceInWorkspace[workSpacesAllocated] = 0;
-									}
-									else
-									{
-										//allocate a new workspace
-										pCurrentWorkSpace = new uint8 [workSpaceSize];
-										workSpaceAllocations[workSpacesAllocated] = pCurrentWorkSpace;
-										usedSpaceInWorkspace[workSpacesAllocated] = 0;
-									}
-
-									roomLeftInWorkSpace = workSpaceSize;
-									++workSpacesAllocated;
-								}
-
-								CPolyhedron *pWorkSpacePolyhedron = CPolyhedron_LumpedMemory::AllocateAt( pCurrentWorkSpace, 
-																											pTempPolyhedron->iVertexCount,
-																											pTempPolyhedron->iLineCount,
-																											pTempPolyhedron->iIndexCount,
-																											pTempPolyhedron->iPolygonCount );
-
-								pCurrentWorkSpace += memRequired;
-								roomLeftInWorkSpace -= memRequired;
-
-								memcpy( pWorkSpacePolyhedron->pVertices, pTempPolyhedron->pVertices, pTempPolyhedron->iVertexCount * sizeof( Vector ) );
-								memcpy( pWorkSpacePolyhedron->pLines, pTempPolyhedron->pLines, pTempPolyhedron->iLineCount * sizeof( Polyhedron_IndexedLine_t ) );
-								memcpy( pWorkSpacePolyhedron->pIndices, pTempPolyhedron->pIndices, pTempPolyhedron->iIndexCount * sizeof( Polyhedron_IndexedLineReference_t ) );
-								memcpy( pWorkSpacePolyhedron->pPolygons, pTempPolyhedron->pPolygons, pTempPolyhedron->iPolygonCount * sizeof( Polyhedron_IndexedPolygon_t ) );
-
-								m_StaticPropPolyhedrons.AddToTail( pWorkSpacePolyhedron );
+	return true;
+}
 
-#ifdef _DEBUG
-								CPhysConvex *pConvex = physcollision->ConvexFromConvexPolyhedron( *pTempPolyhedron );
-								AssertMsg( pConvex != NULL, "Conversion from Convex to Polyhedron was unreversable" );
-								if( pConvex )
-								{
-									physcollision->ConvexFree( pConvex );
-								}
-#endif
+bool CStaticCollisionPolyhedronCache::LoadFromDisk( CRC32_t bspCRC, CRC32_t staticPropCRC )
+{
+	char szMapName[MAX_PATH];
+	GetPolyhedronCacheMapName( szMapName, sizeof( szMapName ) );
+
+	char szCacheName[MAX_PATH];
+	Q_snprintf( szCacheName, sizeof( szCacheName ), "maps/%s.pch", szMapName );
+
+	FileHandle_t hFile = filesystem->Open( szCacheName, "rb", "GAME" );
+	if( hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	PolyhedronCacheFileHeader_t header;
+	if( (filesystem->Read( &header, sizeof( header ), hFile ) != sizeof( header )) ||
+		(header.id != POLYHEDRONCACHE_FILE_ID) ||
+		(header.iVersion != POLYHEDRONCACHE_FILE_VERSION) ||
+		(header.iLumpedPolyhedronSize != sizeof( CPolyhedron_LumpedMemory )) ||
+		(header.bspCRC != bspCRC) ||
+		(header.staticPropCRC != staticPropCRC) ||
+		(header.iBrushCount < 0) || (header.iStaticPropPolyhedronCount < 0) || (header.iStaticPropInfoCount < 0) )
+	{
+		DevMsg( 2, "CStaticCollisionPolyhedronCache: %s is out of date, rebuilding.\n", szCacheName );
+		filesystem->Close( hFile );
+		return false;
+	}
 
-								pTempPolyhedron->Release();
-							}
-						}
-					}
+	Clear();
 
-					cacheInfo.iNumPolyhedrons = m_StaticPropPolyhedrons.Count() - cacheInfo.iStartIndex;
-					cacheInfo.iStaticPropIndex = iStaticPropIndex;
-					Assert( staticpropmgr->GetStaticPropByIndex( iStaticPropIndex ) == pProp );
-					
-					m_CollideableIndicesMap.InsertOrReplace( pProp, cacheInfo );
-				}
+	CUtlVector<int> BrushOffsets;
+	CUtlVector<int> StaticPropOffsets;
+	CUtlVector<StaticPropPolyhedronCacheInfo_t> StaticPropInfos;
+	BrushOffsets.SetCount( header.iBrushCount );
+	StaticPropOffsets.SetCount( header.iStaticPropPolyhedronCount );
+	StaticPropInfos.SetCount( header.iStaticPropInfoCount );
 
-				++iStaticPropIndex;
-				++pCollideables;
-			} while( pCollideables != pStop );
+	bool bSuccess = true;
 
+	int iBrushOffsetsSize = header.iBrushCount * sizeof( int );
+	int iStaticPropOffsetsSize = header.iStaticPropPolyhedronCount * sizeof( int );
+	int iStaticPropInfosSize = header.iStaticPropInfoCount * sizeof( StaticPropPolyhedronCacheInfo_t );
 
-			usedSpaceInWorkspace[workSpacesAllocated - 1] = workSpaceSize - roomLeftInWorkSpace;
+	bSuccess = bSuccess && (filesystem->Read( BrushOffsets.Base(), iBrushOffsetsSize, hFile ) == iBrushOffsetsSize);
+	bSuccess = bSuccess && (filesystem->Read( StaticPropOffsets.Base(), iStaticPropOffsetsSize, hFile ) == iStaticPropOffsetsSize);
+	bSuccess = bSuccess && (filesystem->Read( StaticPropInfos.Base(), iStaticPropInfosSize, hFile ) == iStaticPropInfosSize);
 
-			if( usedSpaceInWorkspace[0] != 0 ) //At least a little bit of memory was used.
-			{
-				//consolidate workspaces into a single memory chunk
-				size_t totalMemoryNeeded = 0;
-				for( unsigned int i = 0; i != workSpacesAllocated; ++i )
-				{
-					totalMemoryNeeded += usedSpaceInWorkspace[i];
-				}
+	if( bSuccess && (header.iBrushMemorySize != 0) )
+	{
+		s_BrushPolyhedronMemory = new uint8 [header.iBrushMemorySize];
+		s_iBrushPolyhedronMemorySize = header.iBrushMemorySize;
+		bSuccess = (filesystem->Read( s_BrushPolyhedronMemory, header.iBrushMemorySize, hFile ) == (int)header.iBrushMemorySize);
+	}
 
-				uint8 *pFinalDest = new uint8 [totalMemoryNeeded];
-				s_StaticPropPolyhedronMemory = pFinalDest;
+	if( bSuccess && (header.iStaticPropMemorySize != 0) )
+	{
+		s_StaticPropPolyhedronMemory = new uint8 [header.iStaticPropMemorySize];
+		s_iStaticPropPolyhedronMemorySize = header.iStaticPropMemorySize;
+		bSuccess = (filesystem->Read( s_StaticPropPolyhedronMemory, header.iStaticPropMemorySize, hFile ) == (int)header.iStaticPropMemorySize);
+	}
 
-				DevMsg( 2, "CStaticCollisionPolyhedronCache: Used %.2f KB to cache %d static prop polyhedrons.\n", ((float)totalMemoryNeeded) / 1024.0f, m_StaticPropPolyhedrons.Count() );
+	filesystem->Close( hFile );
 
-				int iCount = m_StaticPropPolyhedrons.Count();
-				for( int i = 0; i != iCount; ++i )
-				{
-					CPolyhedron_LumpedMemory *pSource = (CPolyhedron_LumpedMemory *)m_StaticPropPolyhedrons[i];
-
-					size_t memRequired = (sizeof( CPolyhedron_LumpedMemory )) +
-											(sizeof( Vector ) * pSource->iVertexCount) +
-											(sizeof( Polyhedron_IndexedLine_t ) * pSource->iLineCount) +
-											(sizeof( Polyhedron_IndexedLineReference_t ) * pSource->iIndexCount) +
-											(sizeof( Polyhedron_IndexedPolygon_t ) * pSource->iPolygonCount);
-
-					CPolyhedron_LumpedMemory *pDest = (CPolyhedron_LumpedMemory *)pFinalDest;
-					m_StaticPropPolyhedrons[i] = pDest;
-					pFinalDest += memRequired;
-
-					int memoryOffset = ((uint8 *)pDest) - ((uint8 *)pSource);
-
-					memcpy( pDest, pSource, memRequired );
-					//move all the pointers to their new location.
-					pDest->pVertices = (Vector *)(((uint8 *)(pDest->pVertices)) + memoryOffset);
-					pDest->pLines = (Polyhedron_IndexedLine_t *)(((uint8 *)(pDest->pLines)) + memoryOffset);
-					pDest->pIndices = (Polyhedron_IndexedLineReference_t *)(((uint8 *)(pDest->pIndices)) + memoryOffset);
-					pDest->pPolygons = (Polyhedron_IndexedPolygon_t *)(((uint8 *)(pDest->pPolygons)) + memoryOffset);
-				}
-			}
+	//brushes
+	for( int i = 0; bSuccess && (i != header.iBrushCount); ++i )
+	{
+		if( BrushOffsets[i] == -1 )
+		{
+			m_BrushPolyhedrons.AddToTail( NULL );
+			continue;
+		}
+
+		CPolyhedron *pPolyhedron = RelocateLumpedPolyhedron( (uint8 *)s_BrushPolyhedronMemory, s_iBrushPolyhedronMemorySize, BrushOffsets[i] );
+		bSuccess = (pPolyhedron != NULL);
+		m_BrushPolyhedrons.AddToTail( pPolyhedron );
+	}
+
+	//static props
+	for( int i = 0; bSuccess && (i != header.iStaticPropPolyhedronCount); ++i )
+	{
+		CPolyhedron *pPolyhedron = RelocateLumpedPolyhedron( (uint8 *)s_StaticPropPolyhedronMemory, s_iStaticPropPolyhedronMemorySize, StaticPropOffsets[i] );
+		bSuccess = (pPolyhedron != NULL);
+		m_StaticPropPolyhedrons.AddToTail( pPolyhedron );
+	}
+
+	for( int i = 0; bSuccess && (i != header.iStaticPropInfoCount); ++i )
+	{
+		const StaticPropPolyhedronCacheInfo_t &cacheInfo = StaticPropInfos[i];
+		if( (cacheInfo.iStartIndex < 0) || (cacheInfo.iNumPolyhedrons < 0) ||
+			(cacheInfo.iStartIndex + cacheInfo.iNumPolyhedrons > m_StaticPropPolyhedrons.Count()) )
+		{
+			bSuccess = false;
+			break;
 		}
+
+		ICollideable *pProp = staticpropmgr->GetStaticPropByIndex( cacheInfo.iStaticPropIndex );
+		if( pProp == NULL )
+		{
+			bSuccess = false;
+			break;
+		}
+
+		m_CollideableIndicesMap.InsertOrReplace( pProp, cacheInfo );
 	}
 
-	if( iBrushWorkSpaces > workSpacesAllocated )
-		workSpacesAllocated = iBrushWorkSpaces;
+	if( !bSuccess )
+	{
+		Warning( "CStaticCollisionPolyhedronCache: %s is corrupt, rebuilding.\n", szCacheName );
+		Clear();
+		return false;
+	}
+
+	DevMsg( 2, "CStaticCollisionPolyhedronCache: Loaded %d brush and %d static prop polyhedrons from %s.\n", m_BrushPolyhedrons.Count(), m_StaticPropPolyhedrons.Count(), szCacheName );
+	return true;
+}
+
+void CStaticCollisionPolyhedronCache::SaveToDisk( CRC32_t bspCRC, CRC32_t staticPropCRC )
+{
+	char szMapName[MAX_PATH];
+	GetPolyhedronCacheMapName( szMapName, sizeof( szMapName ) );
+
+	char szCacheName[MAX_PATH];
+	Q_snprintf( szCacheName, sizeof( szCacheName ), "maps/%s.pch", szMapName );
 
-	for( unsigned int i = 0; i != workSpacesAllocated; ++i )
+	char szCacheDir[MAX_PATH];
+	Q_ExtractFilePath( szCacheName, szCacheDir, sizeof( szCacheDir ) );
+	filesystem->CreateDirHierarchy( szCacheDir, "DEFAULT_WRITE_PATH" );
+
+	FileHandle_t hFile = filesystem->Open( szCacheName, "wb", "DEFAULT_WRITE_PATH" );
+	if( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		DevWarning( 2, "CStaticCollisionPolyhedronCache: Couldn't write %s\n", szCacheName );
+		return;
+	}
+
+	PolyhedronCacheFileHeader_t header;
+	header.id = POLYHEDRONCACHE_FILE_ID;
+	header.iVersion = POLYHEDRONCACHE_FILE_VERSION;
+	header.iLumpedPolyhedronSize = sizeof( CPolyhedron_LumpedMemory );
+	header.bspCRC = bspCRC;
+	header.staticPropCRC = staticPropCRC;
+	header.iBrushCount = m_BrushPolyhedrons.Count();
+	header.iStaticPropPolyhedronCount = m_StaticPropPolyhedrons.Count();
+	header.iStaticPropInfoCount = m_CollideableIndicesMap.Count();
+	header.iBrushMemorySize = (unsigned int)s_iBrushPolyhedronMemorySize;
+	header.iStaticPropMemorySize = (unsigned int)s_iStaticPropPolyhedronMemorySize;
+
+	filesystem->Write( &header, sizeof( header ), hFile );
+
+	for( int i = 0; i != header.iBrushCount; ++i )
+	{
+		int iOffset = (m_BrushPolyhedrons[i] != NULL) ? (int)(((uint8 *)m_BrushPolyhedrons[i]) - ((uint8 *)s_BrushPolyhedronMemory)) : -1;
+		filesystem->Write( &iOffset, sizeof( int ), hFile );
+	}
+
+	for( int i = 0; i != header.iStaticPropPolyhedronCount; ++i )
 	{
-		delete []workSpaceAllocations[i];
+		int iOffset = (int)(((uint8 *)m_StaticPropPolyhedrons[i]) - ((uint8 *)s_StaticPropPolyhedronMemory));
+		filesystem->Write( &iOffset, sizeof( int ), hFile );
 	}
+
+	for( unsigned short i = m_CollideableIndicesMap.FirstInorder(); m_CollideableIndicesMap.IsValidIndex( i ); i = m_CollideableIndicesMap.NextInorder( i ) )
+	{
+		filesystem->Write( &m_CollideableIndicesMap.Element( i ), sizeof( StaticPropPolyhedronCacheInfo_t ), hFile );
+	}
+
+	if( s_iBrushPolyhedronMemorySize != 0 )
+		filesystem->Write( s_BrushPolyhedronMemory, (int)s_iBrushPolyhedronMemorySize, hFile );
+
+	if( s_iStaticPropPolyhedronMemorySize != 0 )
+		filesystem->Write( s_StaticPropPolyhedronMemory, (int)s_iStaticPropPolyhedronMemorySize, hFile );
+
+	filesystem->Close( hFile );
+
+	DevMsg( 2, "CStaticCollisionPolyhedronCache: Wrote %s\n", szCacheName );
 }
 
 
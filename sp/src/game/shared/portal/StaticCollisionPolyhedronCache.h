@@ -13,6 +13,7 @@
 #include "tier1/utlvector.h"
 #include "tier1/utlstring.h"
 #include "tier1/utlmap.h"
+#include "tier1/checksum_crc.h"
 
 
 
@@ -47,6 +48,11 @@ private:
 
 	void Clear( void );
 	void Update( void );
+
+	//on-disk cache of the Update() results, see comments in the implementation for file layout
+	bool ComputeCacheKey( CRC32_t *pBSPCRC, CRC32_t *pStaticPropCRC );
+	bool LoadFromDisk( CRC32_t bspCRC, CRC32_t staticPropCRC );
+	void SaveToDisk( CRC32_t bspCRC, CRC32_t staticPropCRC );
 };
 
 extern CStaticCollisionPolyhedronCache g_StaticCollisionPolyhedronCache;
@@ -16,6 +16,8 @@
 #if defined( CLIENT_DLL )
 	#include "c_portal_player.h"
 	#include "c_rumble.h"
+	#include "prediction.h"
+	#include "con_nprint.h"
 #else
 	#include "portal_player.h"
 	#include "env_player_surface_trigger.h"
@@ -29,12 +31,100 @@
 #include "tier0/memdbgon.h"
 
 ConVar sv_player_trace_through_portals("sv_player_trace_through_portals", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Causes player movement traces to trace through portals." );
+ConVar sv_player_trace_cache("sv_player_trace_cache", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Reuse identical player movement traces within a single ProcessMovement()." );
 ConVar sv_player_funnel_into_portals("sv_player_funnel_into_portals", "1", FCVAR_REPLICATED | FCVAR_ARCHIVE | FCVAR_ARCHIVE_XBOX, "Causes the player to auto correct toward the center of floor portals." ); 
 
 class CReservePlayerSpot;
 
 #define PORTAL_FUNNEL_AMOUNT 6.0f
 
+#define PLAYER_TRACE_CACHE_SIZE 4
+
+struct PlayerTraceStats_t
+{
+	unsigned int iTraces;
+	unsigned int iCacheHits;
+	unsigned int iPortalTraces; //fell through to UTIL_Portal_TraceEntity()
+	unsigned int iPortalTracesSkipped; //zero length, UTIL_Portal_TraceEntity() couldn't have changed the result
+};
+static PlayerTraceStats_t s_PlayerTraceStats;
+
+#ifdef CLIENT_DLL
+CON_COMMAND_F( cl_player_trace_stats, "Print and reset client player movement trace counters.", FCVAR_CHEAT )
+#else
+CON_COMMAND_F( sv_player_trace_stats, "Print and reset server player movement trace counters.", FCVAR_CHEAT )
+#endif
+{
+	const PlayerTraceStats_t &stats = s_PlayerTraceStats;
+	Msg( "%u player traces: %u from cache (%.1f%%), %u portal traces, %u portal traces skipped\n",
+		stats.iTraces, stats.iCacheHits, (stats.iTraces != 0) ? (100.0f * (float)stats.iCacheHits / (float)stats.iTraces) : 0.0f,
+		stats.iPortalTraces, stats.iPortalTracesSkipped );
+
+	memset( &s_PlayerTraceStats, 0, sizeof( s_PlayerTraceStats ) );
+}
+
+#ifdef CLIENT_DLL
+static ConVar cl_portal_prediction_stats( "cl_portal_prediction_stats", "0", FCVAR_CHEAT, "Show how many movement commands were predicted or replayed each frame and the traces they cost." );
+
+// Prediction replays every unacknowledged command after an error, and a portal teleport is always
+// an error on the client since the server does the teleporting. This shows what those replays cost.
+struct PortalPredictionFrameStats_t
+{
+	int iFrame;
+	int iCommands;
+	int iReplayedCommands;
+	int iPortalEnvCommands;
+	int iTraces;
+	int iReplayedTraces;
+	int iPortalFallbacks; //UTIL_Portal_TraceEntity() retraces, counted apart from iTraces so a fallback isn't a second trace
+};
+static PortalPredictionFrameStats_t s_PortalPredictionFrameStats;
+
+static void PortalPredictionStats_NoteCommand( bool bInPortalEnv )
+{
+	PortalPredictionFrameStats_t &stats = s_PortalPredictionFrameStats;
+	if( stats.iFrame != gpGlobals->framecount )
+	{
+		if( cl_portal_prediction_stats.GetBool() && (stats.iCommands != 0) )
+		{
+			con_nprint_t np;
+			np.fixed_width_font = true;
+			np.color[0] = 1.0f;
+			np.color[1] = 0.95f;
+			np.color[2] = 0.7f;
+			np.time_to_live = 2.0f;
+
+			np.index = 40;
+			engine->Con_NXPrintf( &np, "portal pred: %2d cmds (%2d replayed, %2d in portal env)", stats.iCommands, stats.iReplayedCommands, stats.iPortalEnvCommands );
+			np.index = 41;
+			engine->Con_NXPrintf( &np, "portal pred: %3d traces (%3d replayed, %3d portal fallbacks)", stats.iTraces, stats.iReplayedTraces, stats.iPortalFallbacks );
+		}
+
+		memset( &stats, 0, sizeof( stats ) );
+		stats.iFrame = gpGlobals->framecount;
+	}
+
+	++stats.iCommands;
+	if( !prediction->IsFirstTimePredicted() )
+		++stats.iReplayedCommands;
+	if( bInPortalEnv )
+		++stats.iPortalEnvCommands;
+}
+
+static void PortalPredictionStats_NoteTrace( void )
+{
+	PortalPredictionFrameStats_t &stats = s_PortalPredictionFrameStats;
+	++stats.iTraces;
+	if( !prediction->IsFirstTimePredicted() )
+		++stats.iReplayedTraces;
+}
+
+static void PortalPredictionStats_NotePortalFallback( void )
+{
+	++s_PortalPredictionFrameStats.iPortalFallbacks;
+}
+#endif
+
 extern bool g_bAllowForcePortalTrace;
 extern bool g_bForcePortalTrace;
 
@@ -96,6 +186,26 @@ private:
 
 
 	CPortal_Player	*GetPortalPlayer();
+
+	// Nothing the player collides with moves while the player does, so identical traces within
+	// one ProcessMovement() (TestPlayerPosition() at the same spot, repeated ground checks) can be reused
+	struct CachedPlayerTrace_t
+	{
+		Vector vStart;
+		Vector vEnd;
+		Vector vMins;
+		Vector vMaxs;
+		unsigned int fMask;
+		int collisionGroup;
+		CProp_Portal *pPortalEnvironment;
+		trace_t trace;
+	};
+	CachedPlayerTrace_t m_CachedTraces[PLAYER_TRACE_CACHE_SIZE];
+	int		m_iCachedTraceCount;
+	int		m_iNextCachedTrace;
+	bool	m_bTraceCacheValid; //only while inside ProcessMovement()
+
+	void	ResetPlayerTraceCache( void ) { m_iCachedTraceCount = 0; m_iNextCachedTrace = 0; }
 };
 
 //-----------------------------------------------------------------------------
@@ -103,6 +213,9 @@ private:
 //-----------------------------------------------------------------------------
 CPortalGameMovement::CPortalGameMovement()
 {
+	m_iCachedTraceCount = 0;
+	m_iNextCachedTrace = 0;
+	m_bTraceCacheValid = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -128,6 +241,7 @@ void CPortalGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMov
 	gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
 
 	ResetGetPointContentsCache();
+	ResetPlayerTraceCache();
 
 	// Cropping movement speed scales mv->m_fForwardSpeed etc. globally
 	// Once we crop, we don't want to recursively crop again, so we set the crop
@@ -143,11 +257,19 @@ void CPortalGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMov
 	g_bAllowForcePortalTrace = m_bInPortalEnv;
 	g_bForcePortalTrace = m_bInPortalEnv;
 
+#ifdef CLIENT_DLL
+	PortalPredictionStats_NoteCommand( m_bInPortalEnv );
+#endif
+
+	m_bTraceCacheValid = sv_player_trace_cache.GetBool();
+
 	// Run the command.
 	PlayerMove();
 
 	FinishMove();
 
+	m_bTraceCacheValid = false;
+
 	g_bAllowForcePortalTrace = false;
 	g_bForcePortalTrace = false;
 
@@ -685,8 +807,29 @@ void CPortalGameMovement::TracePlayerBBox( const Vector& start, const Vector& en
 	
 	CPortal_Player *pPortalPlayer = (CPortal_Player *)((CBaseEntity *)mv->m_nPlayerHandle.Get());
 
+	Vector vMins = GetPlayerMins();
+	Vector vMaxs = GetPlayerMaxs();
+
+	++s_PlayerTraceStats.iTraces;
+	if( m_bTraceCacheValid )
+	{
+		for( int i = 0; i != m_iCachedTraceCount; ++i )
+		{
+			const CachedPlayerTrace_t &cached = m_CachedTraces[i];
+			if( (cached.fMask == fMask) && (cached.collisionGroup == collisionGroup) &&
+				(cached.vStart == start) && (cached.vEnd == end) &&
+				(cached.vMins == vMins) && (cached.vMaxs == vMaxs) &&
+				(cached.pPortalEnvironment == pPortalPlayer->m_hPortalEnvironment.Get()) )
+			{
+				++s_PlayerTraceStats.iCacheHits;
+				pm = cached.trace;
+				return;
+			}
+		}
+	}
+
 	Ray_t ray;
-	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
+	ray.Init( start, end, vMins, vMaxs );
 
 #ifdef CLIENT_DLL
 	CTraceFilterSimple traceFilter( mv->m_nPlayerHandle.Get(), collisionGroup );
@@ -696,18 +839,51 @@ void CPortalGameMovement::TracePlayerBBox( const Vector& start, const Vector& en
 #endif
 
 	UTIL_Portal_TraceRay_With( pPortalPlayer->m_hPortalEnvironment, ray, fMask, &traceFilter, &pm );
+#ifdef CLIENT_DLL
+	PortalPredictionStats_NoteTrace();
+#endif
 
 	// If we're moving through a portal and failed to hit anything with the above ray trace
 	// Use UTIL_Portal_TraceEntity to test this movement through a portal and override the trace with the result
-	if ( pm.fraction == 1.0f && UTIL_DidTraceTouchPortals( ray, pm ) && sv_player_trace_through_portals.GetBool() )
+	if ( pm.fraction == 1.0f && sv_player_trace_through_portals.GetBool() )
 	{
-		trace_t tempTrace;
-		UTIL_Portal_TraceEntity( pPortalPlayer, start, end, fMask, &traceFilter, &tempTrace );
-
-		if ( tempTrace.DidHit() && tempTrace.fraction < pm.fraction && !tempTrace.startsolid && !tempTrace.allsolid )
+		if ( ray.m_IsSwept == false )
 		{
-			pm = tempTrace;
+			// Anything a zero length trace hits is startsolid, which the override below rejects anyways
+			++s_PlayerTraceStats.iPortalTracesSkipped;
 		}
+		else if ( UTIL_DidTraceTouchPortals( ray, pm ) )
+		{
+			++s_PlayerTraceStats.iPortalTraces;
+#ifdef CLIENT_DLL
+			PortalPredictionStats_NotePortalFallback();
+#endif
+
+			trace_t tempTrace;
+			UTIL_Portal_TraceEntity( pPortalPlayer, start, end, fMask, &traceFilter, &tempTrace );
+
+			if ( tempTrace.DidHit() && tempTrace.fraction < pm.fraction && !tempTrace.startsolid && !tempTrace.allsolid )
+			{
+				pm = tempTrace;
+			}
+		}
+	}
+
+	if( m_bTraceCacheValid )
+	{
+		CachedPlayerTrace_t &cached = m_CachedTraces[m_iNextCachedTrace];
+		cached.vStart = start;
+		cached.vEnd = end;
+		cached.vMins = vMins;
+		cached.vMaxs = vMaxs;
+		cached.fMask = fMask;
+		cached.collisionGroup = collisionGroup;
+		cached.pPortalEnvironment = pPortalPlayer->m_hPortalEnvironment.Get();
+		cached.trace = pm;
+
+		m_iNextCachedTrace = (m_iNextCachedTrace + 1) % PLAYER_TRACE_CACHE_SIZE;
+		if( m_iCachedTraceCount < PLAYER_TRACE_CACHE_SIZE )
+			++m_iCachedTraceCount;
 	}
 }
 
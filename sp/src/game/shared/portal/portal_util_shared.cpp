@@ -13,6 +13,7 @@
 #include "beam_shared.h"
 #include "collisionutils.h"
 #include "util_shared.h"
+#include "raytrace.h"
 #ifndef CLIENT_DLL
 	#include "util.h"
 	#include "ndebugoverlay.h"
@@ -31,6 +32,8 @@ ConVar sv_portal_trace_vs_displacements ("sv_portal_trace_vs_displacements", "1"
 ConVar sv_portal_trace_vs_holywall ("sv_portal_trace_vs_holywall", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Use traces against portal environment carved wall" );
 ConVar sv_portal_trace_vs_staticprops ("sv_portal_trace_vs_staticprops", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Use traces against portal environment static prop geometry" );
 ConVar sv_use_find_closest_passable_space ("sv_use_find_closest_passable_space", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Enables heavy-handed player teleporting stuck fix code." );
+ConVar sv_find_closest_passable_space_swept_hull ("sv_find_closest_passable_space_swept_hull", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Try pushing stuck entities out along a few swept hull probes before falling back to iterative corner tracing." );
+ConVar sv_find_closest_passable_space_max_iterations ("sv_find_closest_passable_space_max_iterations", "100", FCVAR_REPLICATED | FCVAR_CHEAT, "Maximum iterations of corner tracing FindClosestPassableSpace() does before giving up.", true, 1.0f, true, 100.0f );
 ConVar sv_use_transformed_collideables("sv_use_transformed_collideables", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Disables traces against remote portal moving entities using transforms to bring them into local space." );
 
 ConVar portal_1_color("portal_1_color", "148 0 212", FCVAR_REPLICATED, "Sets the colour used to determine the blue portal colours.");
@@ -216,23 +219,23 @@ CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserT
 	int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
 	if( iPortalCount != 0 )
 	{
-		CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+		//only portals whose bounds the ray actually passes through need the full intersection test
+		CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof(CProp_Portal *) * iPortalCount );
+		iPortalCount = CProp_Portal_Shared::GetPortalsAlongRay( ray, pPortals, iPortalCount );
 
 		for( int i = 0; i != iPortalCount; ++i )
 		{
 			CProp_Portal *pTempPortal = pPortals[i];
-			if( pTempPortal->IsActivedAndLinked() )
+			
+			//check directionality first, it's far cheaper than the triangle tests
+			if( pTempPortal->m_plane_Origin.normal.Dot( ray.m_Delta ) < 0.0f )
 			{
 				float fIntersection = UTIL_IntersectRayWithPortal( ray, pTempPortal );
 				if( fIntersection >= 0.0f && fIntersection < fMustBeCloserThan )
 				{
-					//within range, now check directionality
-					if( pTempPortal->m_plane_Origin.normal.Dot( ray.m_Delta ) < 0.0f )
-					{
-						//qualifies for consideration, now it just has to compete for closest
-						pIntersectedPortal = pTempPortal;
-						fMustBeCloserThan = fIntersection;
-					}
+					//qualifies for consideration, now it just has to compete for closest
+					pIntersectedPortal = pTempPortal;
+					fMustBeCloserThan = fIntersection;
 				}
 			}
 		}
@@ -242,6 +245,209 @@ CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserT
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Same results as calling UTIL_Portal_FirstAlongRay() on each ray, but the rays
+//			are packed four at a time and tested against the portals the spatial index finds
+//			around each packet with SIMD math.
+//			For callers that fire a bunch of line traces at the same handful of portals.
+// Input  : pRays - line rays, extents are ignored
+//			iRayCount - number of rays
+//			pMustBeCloserThan - per ray, in: fraction a portal must be closer than, out: fraction of the portal hit (untouched on a miss)
+//			pPortalsOut - per ray, the closest front facing portal the ray passes through, or NULL
+//-----------------------------------------------------------------------------
+void UTIL_Portal_FirstAlongRays( const Ray_t *pRays, int iRayCount, float *pMustBeCloserThan, CProp_Portal **pPortalsOut )
+{
+	for( int i = 0; i != iRayCount; ++i )
+		pPortalsOut[i] = NULL;
+
+	int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
+	if( (iPortalCount == 0) || (iRayCount == 0) )
+		return;
+
+	//flatten out the portal rectangles once, every ray packet reuses them
+	struct PortalRect_t
+	{
+		CProp_Portal *pPortal;
+		Vector vForward, vRight, vUp;
+		Vector ptCenter;
+		float fPlaneDist;
+	};
+
+	PortalRect_t *pRects = (PortalRect_t *)stackalloc( sizeof( PortalRect_t ) * iPortalCount );
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+
+	const fltx4 fl4HalfWidth = ReplicateX4( PORTAL_HALF_WIDTH );
+	const fltx4 fl4HalfHeight = ReplicateX4( PORTAL_HALF_HEIGHT );
+
+	for( int iRayBase = 0; iRayBase < iRayCount; iRayBase += 4 )
+	{
+		//pad a partial packet by repeating its last ray, the extra lanes are never written out
+		int iLanes = MIN( 4, iRayCount - iRayBase );
+		int iRayIndex[4];
+		for( int i = 0; i != 4; ++i )
+			iRayIndex[i] = iRayBase + MIN( i, iLanes - 1 );
+
+		//only portals the spatial index finds near the packet need testing, query it with the box around all of the packet's segments
+		Vector vPacketMins, vPacketMaxs;
+		ClearBounds( vPacketMins, vPacketMaxs );
+		for( int i = 0; i != iLanes; ++i )
+		{
+			const Ray_t &ray = pRays[iRayBase + i];
+			AddPointToBounds( ray.m_Start, vPacketMins, vPacketMaxs );
+			AddPointToBounds( ray.m_Start + ray.m_Delta, vPacketMins, vPacketMaxs );
+		}
+
+		Ray_t packetBounds;
+		Vector vPacketCenter = (vPacketMins + vPacketMaxs) * 0.5f;
+		packetBounds.Init( vPacketCenter, vPacketCenter, vPacketMins - vPacketCenter, vPacketMaxs - vPacketCenter );
+
+		int iRectCount = CProp_Portal_Shared::GetPortalsAlongRay( packetBounds, pPortals, iPortalCount );
+		if( iRectCount == 0 )
+			continue;
+
+		for( int i = 0; i != iRectCount; ++i )
+		{
+			PortalRect_t &rect = pRects[i];
+			rect.pPortal = pPortals[i];
+			rect.pPortal->GetVectors( &rect.vForward, &rect.vRight, &rect.vUp );
+			rect.ptCenter = rect.pPortal->GetAbsOrigin();
+			rect.fPlaneDist = rect.vForward.Dot( rect.ptCenter );
+		}
+
+		FourRays rays;
+		rays.origin.LoadAndSwizzle( pRays[iRayIndex[0]].m_Start, pRays[iRayIndex[1]].m_Start, pRays[iRayIndex[2]].m_Start, pRays[iRayIndex[3]].m_Start );
+		rays.direction.LoadAndSwizzle( pRays[iRayIndex[0]].m_Delta, pRays[iRayIndex[1]].m_Delta, pRays[iRayIndex[2]].m_Delta, pRays[iRayIndex[3]].m_Delta );
+
+		fltx4 fl4Closest;
+		for( int i = 0; i != 4; ++i )
+			SubFloat( fl4Closest, i ) = pMustBeCloserThan[iRayIndex[i]];
+
+		int iClosestRect[4] = { -1, -1, -1, -1 };
+
+		for( int i = 0; i != iRectCount; ++i )
+		{
+			const PortalRect_t &rect = pRects[i];
+
+			//rays have to be heading into the front of the portal
+			fltx4 fl4DeltaDotNormal = rays.direction * rect.vForward;
+			fltx4 fl4Mask = CmpLtSIMD( fl4DeltaDotNormal, Four_Zeros );
+			if( !IsAnyNegative( fl4Mask ) )
+				continue;
+
+			//fraction along each ray where it crosses the portal plane
+			fltx4 fl4StartDist = SubSIMD( rays.origin * rect.vForward, ReplicateX4( rect.fPlaneDist ) );
+			fltx4 fl4T = DivSIMD( fl4StartDist, SubSIMD( Four_Zeros, fl4DeltaDotNormal ) );
+			fl4Mask = AndSIMD( fl4Mask, CmpGeSIMD( fl4T, Four_Zeros ) );
+			fl4Mask = AndSIMD( fl4Mask, CmpLeSIMD( fl4T, Four_Ones ) ); //the portal has to be within the segment, pMustBeCloserThan can be > 1
+			fl4Mask = AndSIMD( fl4Mask, CmpLtSIMD( fl4T, fl4Closest ) );
+			if( !IsAnyNegative( fl4Mask ) )
+				continue;
+
+			//and the crossing point has to be inside the portal rectangle
+			FourVectors vCenterToHit = rays.direction;
+			vCenterToHit *= fl4T;
+			vCenterToHit += rays.origin;
+			FourVectors vCenter;
+			vCenter.DuplicateVector( rect.ptCenter );
+			vCenterToHit -= vCenter;
+
+			fl4Mask = AndSIMD( fl4Mask, CmpInBoundsSIMD( vCenterToHit * rect.vRight, fl4HalfWidth ) );
+			fl4Mask = AndSIMD( fl4Mask, CmpInBoundsSIMD( vCenterToHit * rect.vUp, fl4HalfHeight ) );
+
+			int iHitMask = TestSignSIMD( fl4Mask );
+			if( iHitMask == 0 )
+				continue;
+
+			fl4Closest = MaskedAssign( fl4Mask, fl4T, fl4Closest );
+			for( int j = 0; j != 4; ++j )
+			{
+				if( iHitMask & (1 << j) )
+					iClosestRect[j] = i;
+			}
+		}
+
+		for( int i = 0; i != iLanes; ++i )
+		{
+			if( iClosestRect[i] != -1 )
+			{
+				pPortalsOut[iRayBase + i] = pRects[iClosestRect[i]].pPortal;
+				pMustBeCloserThan[iRayBase + i] = SubFloat( fl4Closest, i );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Fires rays at every active portal and checks UTIL_Portal_FirstAlongRays() against
+// UTIL_Portal_FirstAlongRay(). Half the rays end short of the portal plane, and all of
+// them use the 2.0 "must be closer than" that npc_rocket_turret passes in.
+//-----------------------------------------------------------------------------
+#ifdef CLIENT_DLL
+CON_COMMAND_F( cl_portal_first_along_rays_test, "Compare batched and single ray portal intersection results against the active portals.", FCVAR_CHEAT )
+#else
+CON_COMMAND_F( sv_portal_first_along_rays_test, "Compare batched and single ray portal intersection results against the active portals.", FCVAR_CHEAT )
+#endif
+{
+	const int iRaysPerPortal = 32;
+	int iRaysTested = 0;
+	int iHits = 0;
+	int iMismatches = 0;
+
+	int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
+	for( int i = 0; i != iPortalCount; ++i )
+	{
+		CProp_Portal *pPortal = CProp_Portal_Shared::AllPortals[i];
+		if( !pPortal->IsActivedAndLinked() )
+			continue;
+
+		Vector vForward, vRight, vUp;
+		pPortal->GetVectors( &vForward, &vRight, &vUp );
+
+		Ray_t rays[iRaysPerPortal];
+		for( int j = 0; j != iRaysPerPortal; ++j )
+		{
+			//aim a little past the portal edges so misses get tested too
+			Vector ptTarget = pPortal->GetAbsOrigin() + 
+								vRight * RandomFloat( -PORTAL_HALF_WIDTH * 1.25f, PORTAL_HALF_WIDTH * 1.25f ) +
+								vUp * RandomFloat( -PORTAL_HALF_HEIGHT * 1.25f, PORTAL_HALF_HEIGHT * 1.25f );
+			Vector ptStart = ptTarget + 
+								vForward * RandomFloat( 16.0f, 512.0f ) +
+								vRight * RandomFloat( -128.0f, 128.0f ) +
+								vUp * RandomFloat( -128.0f, 128.0f );
+
+			float fLength = (j & 1) ? RandomFloat( 0.1f, 0.95f ) : RandomFloat( 1.05f, 3.0f );
+			rays[j].Init( ptStart, ptStart + (ptTarget - ptStart) * fLength );
+		}
+
+		float fBatchCloserThan[iRaysPerPortal];
+		CProp_Portal *pBatchPortals[iRaysPerPortal];
+		for( int j = 0; j != iRaysPerPortal; ++j )
+			fBatchCloserThan[j] = 2.0f;
+
+		UTIL_Portal_FirstAlongRays( rays, iRaysPerPortal, fBatchCloserThan, pBatchPortals );
+
+		for( int j = 0; j != iRaysPerPortal; ++j )
+		{
+			float fCloserThan = 2.0f;
+			CProp_Portal *pScalarPortal = UTIL_Portal_FirstAlongRay( rays[j], fCloserThan );
+
+			++iRaysTested;
+			if( pScalarPortal )
+				++iHits;
+
+			if( (pScalarPortal != pBatchPortals[j]) || (fabs( fCloserThan - fBatchCloserThan[j] ) > 0.001f) )
+			{
+				++iMismatches;
+				Warning( "Ray %d at portal %d: single ray hit %d at %f, batch hit %d at %f\n", j, pPortal->entindex(),
+					pScalarPortal ? pScalarPortal->entindex() : -1, fCloserThan,
+					pBatchPortals[j] ? pBatchPortals[j]->entindex() : -1, fBatchCloserThan[j] );
+			}
+		}
+	}
+
+	Msg( "%d rays tested, %d hit a portal, %d mismatches\n", iRaysTested, iHits, iMismatches );
+}
+
 bool UTIL_Portal_TraceRay_Bullets( const CProp_Portal *pPortal, const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace, bool bTraceHolyWall )
 {
 	if( !pPortal || !pPortal->IsActivedAndLinked() )
@@ -476,7 +682,6 @@ bool UTIL_DidTraceTouchPortals( const Ray_t& ray, const trace_t& trace, CProp_Po
 		return false;
 	}
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
 	CProp_Portal *pIntersectedPortal = NULL;
 
 	if( ray.m_IsSwept )
@@ -494,17 +699,18 @@ bool UTIL_DidTraceTouchPortals( const Ray_t& ray, const trace_t& trace, CProp_Po
 		CProp_Portal **pBoxIntersectsPortals = (CProp_Portal **)stackalloc( sizeof(CProp_Portal *) * iPortalCount );
 		int iBoxIntersectsPortalsCount = 0;
 
-		for( int i = 0; i != iPortalCount; ++i )
+		Ray_t rayEndBox;
+		rayEndBox.Init( ptRayEndPoint, ptRayEndPoint, -ray.m_Extents, ray.m_Extents );
+		CProp_Portal **pNearbyPortals = (CProp_Portal **)stackalloc( sizeof(CProp_Portal *) * iPortalCount );
+		int iNearbyPortalCount = CProp_Portal_Shared::GetPortalsAlongRay( rayEndBox, pNearbyPortals, iPortalCount );
+
+		for( int i = 0; i != iNearbyPortalCount; ++i )
 		{
-			CProp_Portal *pTempPortal = pPortals[i];
-			if( (pTempPortal->m_bActivated) && 
-				(pTempPortal->m_hLinkedPortal.Get() != NULL) )
+			CProp_Portal *pTempPortal = pNearbyPortals[i];
+			if( UTIL_IsBoxIntersectingPortal( ptRayEndPoint, ray.m_Extents, pTempPortal, 0.00f ) )
 			{
-				if( UTIL_IsBoxIntersectingPortal( ptRayEndPoint, ray.m_Extents, pTempPortal, 0.00f ) )
-				{
-					pBoxIntersectsPortals[iBoxIntersectsPortalsCount] = pTempPortal;
-					++iBoxIntersectsPortalsCount;
-				}
+				pBoxIntersectsPortals[iBoxIntersectsPortalsCount] = pTempPortal;
+				++iBoxIntersectsPortalsCount;
 			}
 		}
 
@@ -1489,13 +1695,14 @@ CProp_Portal *UTIL_IntersectEntityExtentsWithPortal( const CBaseEntity *pEntity
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	Ray_t rayExtents;
+	rayExtents.Init( ptCenter, ptCenter, -vExtents, vExtents );
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof(CProp_Portal *) * iPortalCount );
+	iPortalCount = CProp_Portal_Shared::GetPortalsAlongRay( rayExtents, pPortals, iPortalCount );
+
 	for( int i = 0; i != iPortalCount; ++i )
 	{
-		CProp_Portal *pTempPortal = pPortals[i];
-		if( pTempPortal->m_bActivated && 
-			(pTempPortal->m_hLinkedPortal.Get() != NULL) &&
-			UTIL_IsBoxIntersectingPortal( ptCenter, vExtents, pTempPortal )	)
+		if( UTIL_IsBoxIntersectingPortal( ptCenter, vExtents, pPortals[i] ) )
 		{
 			return pPortals[i];
 		}
@@ -1524,6 +1731,88 @@ void UTIL_Portal_NDebugOverlay( const CProp_Portal *pPortal, int r, int g, int b
 }
 
 
+struct FindClosestPassableSpaceStats_t
+{
+	unsigned int iCalls;
+	unsigned int iAlreadyPassable;
+	unsigned int iSolvedBySweptHull;
+	unsigned int iSolvedByIteration;
+	unsigned int iFailures;
+	unsigned int iIterations;
+	unsigned int iTraces;
+	unsigned int iMostTracesInOneCall;
+};
+static FindClosestPassableSpaceStats_t s_FindClosestPassableSpaceStats;
+
+#ifdef CLIENT_DLL
+CON_COMMAND_F( cl_find_closest_passable_space_stats, "Print and reset client FindClosestPassableSpace() counters.", FCVAR_CHEAT )
+#else
+CON_COMMAND_F( sv_find_closest_passable_space_stats, "Print and reset server FindClosestPassableSpace() counters.", FCVAR_CHEAT )
+#endif
+{
+	const FindClosestPassableSpaceStats_t &stats = s_FindClosestPassableSpaceStats;
+	Msg( "%u calls: %u already passable, %u swept hull, %u iterative, %u failed\n",
+		stats.iCalls, stats.iAlreadyPassable, stats.iSolvedBySweptHull, stats.iSolvedByIteration, stats.iFailures );
+	Msg( "%u iterations, %u traces (%.1f per call, worst %u)\n",
+		stats.iIterations, stats.iTraces, (stats.iCalls != 0) ? ((float)stats.iTraces / (float)stats.iCalls) : 0.0f, stats.iMostTracesInOneCall );
+
+	memset( &s_FindClosestPassableSpaceStats, 0, sizeof( s_FindClosestPassableSpaceStats ) );
+}
+
+//-----------------------------------------------------------------------------
+// Cheap first attempt for FindClosestPassableSpace(). Sweeps the entity's hull back toward where it is stuck
+// from a handful of directions. Each sweep stops against whatever surface is pushing the entity out that way,
+// so the closest end position is the smallest push out along those directions. A point trace out to each
+// sweep start keeps us from finding space on the far side of a wall.
+//-----------------------------------------------------------------------------
+static bool FindClosestPassableSpace_SweptHull( CBaseEntity *pEntity, const Vector &ptCenter, const Vector &vExtents, const Vector &vIndecisivePush, unsigned int fMask, int iCollisionGroup, Vector &ptPassableCenter, unsigned int &iTraceCount )
+{
+	Vector vProbeDirections[7] =
+	{
+		Vector( 1.0f, 0.0f, 0.0f ), Vector( -1.0f, 0.0f, 0.0f ),
+		Vector( 0.0f, 1.0f, 0.0f ), Vector( 0.0f, -1.0f, 0.0f ),
+		Vector( 0.0f, 0.0f, 1.0f ), Vector( 0.0f, 0.0f, -1.0f ),
+		vIndecisivePush,
+	};
+	int iProbeCount = 6;
+	if( vProbeDirections[6].NormalizeInPlace() > 0.001f )
+		++iProbeCount;
+
+	float fBestDistSqr = FLT_MAX;
+	trace_t tr;
+
+	for( int i = 0; i != iProbeCount; ++i )
+	{
+		const Vector &vDirection = vProbeDirections[i];
+
+		//far enough that the hull has completely left the space it started in
+		float fProbeDist = 2.0f * ( fabs( vDirection.x ) * vExtents.x + fabs( vDirection.y ) * vExtents.y + fabs( vDirection.z ) * vExtents.z ) + 1.0f;
+		Vector ptProbeStart = ptCenter + vDirection * fProbeDist;
+
+		Ray_t ray;
+		ray.Init( ptCenter, ptProbeStart );
+		UTIL_TraceRay( ray, fMask, pEntity, iCollisionGroup, &tr );
+		++iTraceCount;
+		if( tr.startsolid || (tr.fraction != 1.0f) )
+			continue;
+
+		ray.Init( ptProbeStart, ptCenter, -vExtents, vExtents );
+		UTIL_TraceRay( ray, fMask, pEntity, iCollisionGroup, &tr );
+		++iTraceCount;
+		if( tr.startsolid )
+			continue;
+
+		float fDistSqr = tr.endpos.DistToSqr( ptCenter );
+		if( fDistSqr < fBestDistSqr )
+		{
+			fBestDistSqr = fDistSqr;
+			ptPassableCenter = tr.endpos;
+		}
+	}
+
+	return (fBestDistSqr != FLT_MAX);
+}
+
 bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePush, unsigned int fMask ) //assumes the object is already in a mostly passable space
 {
 	if ( sv_use_find_closest_passable_space.GetBool() == false )
@@ -1537,6 +1826,9 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 	ADD_DEBUG_HISTORY( HISTORY_PLAYER_DAMAGE, UTIL_VarArgs( "RUNNING FIND CLOSEST PASSABLE SPACE on %s..\n", pEntity->GetDebugName() ) );
 #endif
 
+	++s_FindClosestPassableSpaceStats.iCalls;
+	unsigned int iTraceCount = 0;
+
 	Vector ptExtents[8]; //ordering is going to be like 3 bits, where 0 is a min on the related axis, and 1 is a max on the same axis, axis order x y z
 
 	float fExtentsValidation[8]; //some points are more valid than others, and this is our measure
@@ -1582,13 +1874,18 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 
 
 
+	bool bTriedSweptHull = !sv_find_closest_passable_space_swept_hull.GetBool();
+	bool bUsingSweptHullResult = false;
+
+	unsigned int iMaxIterations = sv_find_closest_passable_space_max_iterations.GetInt();
 	unsigned int iFailCount;
-	for( iFailCount = 0; iFailCount != 100; ++iFailCount )
+	for( iFailCount = 0; iFailCount != iMaxIterations; ++iFailCount )
 	{
 		entRay.m_Start = ptEntityCenter;
 		entRay.m_Delta = ptEntityOriginalCenter - ptEntityCenter;
 
 		UTIL_TraceRay( entRay, fMask, pEntity, iEntityCollisionGroup, &traces[0] );
+		++iTraceCount;
 		if( traces[0].startsolid == false )
 		{
 			Vector vNewPos = traces[0].endpos + (pEntity->GetAbsOrigin() - ptEntityOriginalCenter);
@@ -1597,9 +1894,33 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 #else
 			pEntity->Teleport( &vNewPos, NULL, NULL );
 #endif
+			if( iFailCount == 0 )
+				++s_FindClosestPassableSpaceStats.iAlreadyPassable;
+			else if( bUsingSweptHullResult )
+				++s_FindClosestPassableSpaceStats.iSolvedBySweptHull;
+			else
+				++s_FindClosestPassableSpaceStats.iSolvedByIteration;
+
+			s_FindClosestPassableSpaceStats.iIterations += iFailCount;
+			s_FindClosestPassableSpaceStats.iTraces += iTraceCount;
+			s_FindClosestPassableSpaceStats.iMostTracesInOneCall = MAX( s_FindClosestPassableSpaceStats.iMostTracesInOneCall, iTraceCount );
 			return true; //current placement worked
 		}
 
+		bUsingSweptHullResult = false;
+		if( !bTriedSweptHull )
+		{
+			//a few sweeps usually find the way out, validate their answer with the trace at the top of the loop
+			bTriedSweptHull = true;
+			Vector ptPassableCenter;
+			if( FindClosestPassableSpace_SweptHull( pEntity, ptEntityOriginalCenter, vOriginalExtents, vIndecisivePush, fMask, iEntityCollisionGroup, ptPassableCenter, iTraceCount ) )
+			{
+				ptEntityCenter = ptPassableCenter;
+				bUsingSweptHullResult = true;
+				continue;
+			}
+		}
+
 		bool bExtentInvalid[8];
 		for( int i = 0; i != 8; ++i )
 		{
@@ -1610,6 +1931,7 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 			ptExtents[i].z += ((i & (1<<2)) ? vEntityMaxs.z : vEntityMins.z);
 
 			bExtentInvalid[i] = enginetrace->PointOutsideWorld( ptExtents[i] );
+			++iTraceCount;
 		}
 
 		unsigned int counter, counter2;
@@ -1626,6 +1948,7 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 				{
 					testRay.m_Start = ptExtents[counter];
 					UTIL_TraceRay( testRay, fMask, pEntity, iEntityCollisionGroup, &traces[0] );
+					++iTraceCount;
 				}
 
 				if( bExtentInvalid[counter2] )
@@ -1635,6 +1958,7 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 					testRay.m_Start = ptExtents[counter2];
 					testRay.m_Delta = -testRay.m_Delta;
 					UTIL_TraceRay( testRay, fMask, pEntity, iEntityCollisionGroup, &traces[1] );
+					++iTraceCount;
 				}
 
 				float fDistance = testRay.m_Delta.Length();
@@ -1687,8 +2011,13 @@ bool FindClosestPassableSpace( CBaseEntity *pEntity, const Vector &vIndecisivePu
 		}		
 	}
 
+	++s_FindClosestPassableSpaceStats.iFailures;
+	s_FindClosestPassableSpaceStats.iIterations += iFailCount;
+	s_FindClosestPassableSpaceStats.iTraces += iTraceCount;
+	s_FindClosestPassableSpaceStats.iMostTracesInOneCall = MAX( s_FindClosestPassableSpaceStats.iMostTracesInOneCall, iTraceCount );
+
 	// X360TBD: Hits in portal devtest
-	AssertMsg( IsX360() || iFailCount != 100, "FindClosestPassableSpace() failure." );
+	AssertMsg( IsX360() || iFailCount != iMaxIterations, "FindClosestPassableSpace() failure." );
 	return false;
 }
 
@@ -31,6 +31,7 @@ Color UTIL_Portal_Color( int iPortal );
 void UTIL_Portal_Trace_Filter( class CTraceFilterSimpleClassnameList *traceFilterPortalShot );
 
 CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserThan );
+void UTIL_Portal_FirstAlongRays( const Ray_t *pRays, int iRayCount, float *pMustBeCloserThan, CProp_Portal **pPortalsOut ); //UTIL_Portal_FirstAlongRay for many line rays at once, 4 rays per SIMD pass
 
 bool UTIL_Portal_TraceRay_Bullets( const CProp_Portal *pPortal, const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace, bool bTraceHolyWall = true );
 CProp_Portal* UTIL_Portal_TraceRay_Beam( const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, float *pfFraction );
@@ -16,6 +16,7 @@
 #include "filesystem.h"
 #include "collisionutils.h"
 #include "tier1/callqueue.h"
+#include "tier1/checksum_crc.h"
 
 #ifndef CLIENT_DLL
 
@@ -44,6 +45,7 @@ extern IPhysicsConstraintEvent *g_pConstraintEvents;
 static ConVar sv_portal_collision_sim_bounds_x( "sv_portal_collision_sim_bounds_x", "200", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
 static ConVar sv_portal_collision_sim_bounds_y( "sv_portal_collision_sim_bounds_y", "200", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
 static ConVar sv_portal_collision_sim_bounds_z( "sv_portal_collision_sim_bounds_z", "252", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
+static ConVar sv_portal_incremental_move( "sv_portal_incremental_move", "1", FCVAR_REPLICATED, "When a portal moves along the same plane, reuse the world collision that's still valid instead of rebuilding it all." );
 
 //#define DEBUG_PORTAL_SIMULATION_CREATION_TIMES //define to output creation timings to developer 2
 //#define DEBUG_PORTAL_COLLISION_ENVIRONMENTS //define this to allow for glview collision dumps of portal simulators
@@ -96,11 +98,14 @@ static int s_iPortalSimulatorGUID = 0; //used in standalone function that have n
 #define PORTAL_HOLE_HALF_WIDTH (PORTAL_HALF_WIDTH + 0.1f)
 
 
-static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList );
+static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList, CUtlVector<int> *pSourceBrushList = NULL );
 static void ClipPolyhedrons( CPolyhedron * const *pExistingPolyhedrons, int iPolyhedronCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList );
 static inline CPolyhedron *TransformAndClipSinglePolyhedron( CPolyhedron *pExistingPolyhedron, const VMatrix &Transform, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fCutEpsilon, bool bUseTempMemory );
 static int GetEntityPhysicsObjects( IPhysicsEnvironment *pEnvironment, CBaseEntity *pEntity, IPhysicsObject **pRetList, int iRetListArraySize );
 static CPhysCollide *ConvertPolyhedronsToCollideable( CPolyhedron **pPolyhedrons, int iPolyhedronCount );
+#ifdef _DEBUG
+static bool PolyhedronsMatch( const CPolyhedron *pPolyhedron1, const CPolyhedron *pPolyhedron2 );
+#endif
 
 #ifndef CLIENT_DLL
 static void UpdateShadowClonesPortalSimulationFlags( const CBaseEntity *pSourceEntity, unsigned int iFlags, int iSourceFlags );
@@ -110,6 +115,42 @@ static bool g_bPlayerIsInSimulator = false;
 static CUtlVector<CPortalSimulator *> s_PortalSimulators;
 CUtlVector<CPortalSimulator *> const &g_PortalSimulators = s_PortalSimulators;
 
+static ConVar sv_portal_collide_cache_size( "sv_portal_collide_cache_size", "32", FCVAR_REPLICATED, "Number of unused portal environment collideables to keep around for when a portal is placed on a spot it has been before. 0 disables the cache." );
+
+//Puzzles constantly re-place portals on the same few spots. Collideables built from the carved up polyhedrons are kept
+//around, keyed on a checksum of the polyhedron geometry, so going back to a spot skips the convex builder entirely.
+//The portal plane is already baked into the clipped geometry, so identical unclipped pieces are shared between placements.
+class CPortalCollideCache
+{
+public:
+	CPortalCollideCache( void ) : m_iUseCounter( 0 ) { };
+
+	CPhysCollide *Acquire( CPolyhedron **pPolyhedrons, int iPolyhedronCount );
+	void Release( CPhysCollide *pCollide );
+	void Flush( void );
+
+private:
+	struct Entry_t
+	{
+		CRC32_t			key;
+		int				iPolyhedronCount;
+		int				iVertexCount;
+		Vector			*pVertices; //copy of every polyhedron's vertices the collideable was built from, checked on a key hit
+		unsigned short	*pPolyhedronVertexCounts;
+		CPhysCollide	*pCollide;
+		int				iRefCount;
+		unsigned int	iLastUsed;
+	};
+
+	static bool EntryMatches( const Entry_t &entry, CPolyhedron **pPolyhedrons, int iPolyhedronCount );
+	static void DestroyEntry( Entry_t &entry );
+	void EvictUnused( int iMaxUnused );
+
+	CUtlVector<Entry_t> m_Entries;
+	unsigned int m_iUseCounter;
+};
+static CPortalCollideCache s_PortalCollideCache;
+
 static CPortalSimulator *s_OwnedEntityMap[MAX_EDICTS] = { NULL };
 static CPortalSimulatorEventCallbacks s_DummyPortalSimulatorCallback;
 
@@ -141,6 +182,13 @@ CPortalSimulator::CPortalSimulator( void )
 	m_CreationChecklist.bLocalPhysicsGenerated = false;
 	m_CreationChecklist.bLinkedPhysicsGenerated = false;
 
+	m_IncrementalMove.bActive = false;
+	m_IncrementalMove.pWorldBrushCollideable = NULL;
+#ifndef CLIENT_DLL
+	m_IncrementalMove.pWorldBrushPhysicsObject = NULL;
+	m_IncrementalMove.pPhysicsEnvironment = NULL;
+#endif
+
 #ifdef PORTAL_SIMULATORS_EMBED_GUID
 	static int s_iPortalSimulatorGUIDAllocator = 0;
 	m_iPortalSimulatorGUID = s_iPortalSimulatorGUIDAllocator++;
@@ -228,6 +276,18 @@ void CPortalSimulator::MoveTo( const Vector &ptCenter, const QAngle &angles )
 	VPlane OldPlane = m_InternalData.Placement.PortalPlane; //used in fixing code
 #endif
 
+	//World collision is only clipped against the portal plane, so sliding along that plane leaves most of it valid.
+	//Everything in the wall is cut around the hole and is always rebuilt.
+	if( sv_portal_incremental_move.GetBool() && m_CreationChecklist.bPolyhedronsGenerated )
+	{
+		Vector vNewForward;
+		AngleVectors( angles, &vNewForward );
+		const VPlane &CurrentPlane = m_InternalData.Placement.PortalPlane;
+		//has to be the plane everything was clipped against, not just close to it, or the reused pieces poke through the new hole
+		if( VectorsAreEqual( vNewForward, CurrentPlane.m_Normal, 1e-6f ) && (fabs( vNewForward.Dot( ptCenter ) - CurrentPlane.m_Dist ) < 0.001f) )
+			StashIncrementalMoveData();
+	}
+
 	//update geometric data
 	{
 		m_InternalData.Placement.ptCenter = ptCenter;
@@ -322,6 +382,7 @@ void CPortalSimulator::MoveTo( const Vector &ptCenter, const QAngle &angles )
 #ifndef CLIENT_DLL
 	CreateAllPhysics();
 #endif
+	ReleaseIncrementalMoveData(); //normally done by CreatePolyhedrons(), but it bails early when collision generation is disabled
 
 #if defined( DEBUG_PORTAL_COLLISION_ENVIRONMENTS ) && !defined( CLIENT_DLL )
 	if(   sv_dump_portalsimulator_collision.GetBool() )
@@ -1203,10 +1264,11 @@ void CPortalSimulator::CreateLocalPhysics( void )
 
 	//World
 	{
-		Assert( m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
+		Assert( (m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject == NULL) || (m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject->GetCollide() == m_InternalData.Simulation.Static.World.Brushes.pCollideable) ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
 		if( m_InternalData.Simulation.Static.World.Brushes.pCollideable != NULL )
 		{
-			m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject = m_InternalData.Simulation.pPhysicsEnvironment->CreatePolyObjectStatic( m_InternalData.Simulation.Static.World.Brushes.pCollideable, m_InternalData.Simulation.Static.SurfaceProperties.surface.surfaceProps, vec3_origin, vec3_angle, &params );
+			if( m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject == NULL ) //may have been carried over by an incremental move
+				m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject = m_InternalData.Simulation.pPhysicsEnvironment->CreatePolyObjectStatic( m_InternalData.Simulation.Static.World.Brushes.pCollideable, m_InternalData.Simulation.Static.SurfaceProperties.surface.surfaceProps, vec3_origin, vec3_angle, &params );
 			
 			if( (m_InternalData.Simulation.pCollisionEntity != NULL) && (m_InternalData.Simulation.pCollisionEntity->VPhysicsGetObject() == NULL) )
 				m_InternalData.Simulation.pCollisionEntity->VPhysicsSetObject(m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject);
@@ -1218,7 +1280,9 @@ void CPortalSimulator::CreateLocalPhysics( void )
 #ifdef _DEBUG
 		for( int i = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.Count(); --i >= 0; )
 		{
-			Assert( m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i].pPhysicsObject == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
+			//only carried over physics objects exist at this point, and they have to still be built from the representation's collideable
+			const PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
+			Assert( (Representation.pPhysicsObject == NULL) || (Representation.pPhysicsObject->GetCollide() == Representation.pCollide) ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
 		}
 #endif
 		
@@ -1229,9 +1293,9 @@ void CPortalSimulator::CreateLocalPhysics( void )
 			{
 				PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
 				Assert( Representation.pCollide != NULL );
-				Assert( Representation.pPhysicsObject == NULL );
 				
-				Representation.pPhysicsObject = m_InternalData.Simulation.pPhysicsEnvironment->CreatePolyObjectStatic( Representation.pCollide, Representation.iTraceSurfaceProps, vec3_origin, vec3_angle, &params );
+				if( Representation.pPhysicsObject == NULL ) //may have been carried over by an incremental move
+					Representation.pPhysicsObject = m_InternalData.Simulation.pPhysicsEnvironment->CreatePolyObjectStatic( Representation.pCollide, Representation.iTraceSurfaceProps, vec3_origin, vec3_angle, &params );
 				Assert( Representation.pPhysicsObject != NULL );
 				Representation.pPhysicsObject->RecheckCollisionFilter(); //some filters only work after the variable is stored in the class
 			}
@@ -1641,9 +1705,8 @@ void CPortalSimulator::CreateLocalCollision( void )
 	
 	CREATEDEBUGTIMER( worldBrushTimer );
 	STARTDEBUGTIMER( worldBrushTimer );
-	Assert( m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
-	if( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() != 0 )
-		m_InternalData.Simulation.Static.World.Brushes.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() );
+	if( (m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL) && (m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() != 0) ) //may have been carried over by an incremental move
+		m_InternalData.Simulation.Static.World.Brushes.pCollideable = s_PortalCollideCache.Acquire( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() );
 	STOPDEBUGTIMER( worldBrushTimer );
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWorld Brushes=%fms\n", GetPortalSimulatorGUID(), TABSPACING, worldBrushTimer.GetDuration().GetMillisecondsF() ); );
 
@@ -1652,7 +1715,15 @@ void CPortalSimulator::CreateLocalCollision( void )
 #ifdef _DEBUG
 	for( int i = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.Count(); --i >= 0; )
 	{
-		Assert( m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i].pCollide == NULL );
+		//only carried over collideables exist at this point, they have to be what the representation's polyhedrons would build
+		const PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
+		if( Representation.pCollide != NULL )
+		{
+			CPhysCollide *pFreshCollide = ConvertPolyhedronsToCollideable( &m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
+			Assert( (pFreshCollide != NULL) && (physcollision->CollideSize( pFreshCollide ) == physcollision->CollideSize( Representation.pCollide )) );
+			if( pFreshCollide )
+				physcollision->DestroyCollide( pFreshCollide );
+		}
 	}
 #endif
 	Assert( m_InternalData.Simulation.Static.World.StaticProps.bCollisionExists == false ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
@@ -1664,8 +1735,8 @@ void CPortalSimulator::CreateLocalCollision( void )
 		{
 			PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
 			
-			Assert( Representation.pCollide == NULL );
-			Representation.pCollide = ConvertPolyhedronsToCollideable( &pPolyhedronsBase[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
+			if( Representation.pCollide == NULL ) //may have been carried over by an incremental move
+				Representation.pCollide = s_PortalCollideCache.Acquire( &pPolyhedronsBase[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
 			Assert( Representation.pCollide != NULL );
 		}
 	}
@@ -1682,7 +1753,7 @@ void CPortalSimulator::CreateLocalCollision( void )
 		STARTDEBUGTIMER( wallBrushTimer );
 		Assert( m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
 		if( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() != 0 )
-			m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() );
+			m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable = s_PortalCollideCache.Acquire( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() );
 		STOPDEBUGTIMER( wallBrushTimer );
 		DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWall Brushes=%fms\n", GetPortalSimulatorGUID(), TABSPACING, wallBrushTimer.GetDuration().GetMillisecondsF() ); );
 	}
@@ -1691,7 +1762,7 @@ void CPortalSimulator::CreateLocalCollision( void )
 	STARTDEBUGTIMER( wallTubeTimer );
 	Assert( m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
 	if( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() != 0 )
-		m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() );
+		m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable = s_PortalCollideCache.Acquire( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() );
 	STOPDEBUGTIMER( wallTubeTimer );
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWall Tube=%fms\n", GetPortalSimulatorGUID(), TABSPACING, wallTubeTimer.GetDuration().GetMillisecondsF() ); );
 
@@ -1793,19 +1864,19 @@ void CPortalSimulator::ClearLocalCollision( void )
 	
 	if( m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable )
 	{
-		physcollision->DestroyCollide( m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable );
+		s_PortalCollideCache.Release( m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable );
 		m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable = NULL;
 	}
 
 	if( m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable )
 	{
-		physcollision->DestroyCollide( m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable );
+		s_PortalCollideCache.Release( m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable );
 		m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable = NULL;
 	}
 
 	if( m_InternalData.Simulation.Static.World.Brushes.pCollideable )
 	{
-		physcollision->DestroyCollide( m_InternalData.Simulation.Static.World.Brushes.pCollideable );
+		s_PortalCollideCache.Release( m_InternalData.Simulation.Static.World.Brushes.pCollideable );
 		m_InternalData.Simulation.Static.World.Brushes.pCollideable = NULL;
 	}
 
@@ -1817,7 +1888,7 @@ void CPortalSimulator::ClearLocalCollision( void )
 			PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
 			if( Representation.pCollide )
 			{
-				physcollision->DestroyCollide( Representation.pCollide );
+				s_PortalCollideCache.Release( Representation.pCollide );
 				Representation.pCollide = NULL;
 			}
 		}
@@ -1924,10 +1995,57 @@ void CPortalSimulator::CreatePolyhedrons( void )
 			enginetrace->GetBrushesInAABB( vAABBMins, vAABBMaxs, &WorldBrushes, MASK_SOLID_BRUSHONLY|CONTENTS_PLAYERCLIP|CONTENTS_MONSTERCLIP );
 
 			//create locally clipped polyhedrons for the world
+			if( m_IncrementalMove.bActive )
+			{
+				CUtlMap<int, int> ReusableBrushes( LessFunc_Integer );
+				for( int i = m_IncrementalMove.WorldBrushSources.Count(); --i >= 0; )
+					ReusableBrushes.Insert( m_IncrementalMove.WorldBrushSources[i], i );
+
+				for( int i = 0; i != WorldBrushes.Count(); ++i )
+				{
+					unsigned short iReusable = ReusableBrushes.Find( WorldBrushes[i] );
+					if( ReusableBrushes.IsValidIndex( iReusable ) )
+					{
+						int iStashIndex = ReusableBrushes.Element( iReusable );
+#ifdef _DEBUG
+						{
+							CUtlVector<CPolyhedron *> FreshPolyhedrons;
+							ConvertBrushListToClippedPolyhedronList( &WorldBrushes[i], 1, fWorldClipPlane_Reverse, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &FreshPolyhedrons );
+							Assert( (FreshPolyhedrons.Count() == 1) && PolyhedronsMatch( FreshPolyhedrons[0], m_IncrementalMove.WorldBrushPolyhedrons[iStashIndex] ) );
+							for( int j = FreshPolyhedrons.Count(); --j >= 0; )
+								FreshPolyhedrons[j]->Release();
+						}
+#endif
+						m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.AddToTail( m_IncrementalMove.WorldBrushPolyhedrons[iStashIndex] );
+						m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes.AddToTail( WorldBrushes[i] );
+						m_IncrementalMove.WorldBrushPolyhedrons[iStashIndex] = NULL;
+					}
+					else
+					{
+						ConvertBrushListToClippedPolyhedronList( &WorldBrushes[i], 1, fWorldClipPlane_Reverse, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.World.Brushes.Polyhedrons, &m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes );
+					}
+				}
+
+				//the combined collideable is only good if we ended up with exactly the same brushes
+				if( m_IncrementalMove.pWorldBrushCollideable &&
+					(m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes.Count() == m_IncrementalMove.WorldBrushSources.Count()) &&
+					(memcmp( m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes.Base(), m_IncrementalMove.WorldBrushSources.Base(), m_IncrementalMove.WorldBrushSources.Count() * sizeof( int ) ) == 0) )
+				{
+					Assert( m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL );
+					m_InternalData.Simulation.Static.World.Brushes.pCollideable = m_IncrementalMove.pWorldBrushCollideable;
+					m_IncrementalMove.pWorldBrushCollideable = NULL;
+#ifndef CLIENT_DLL
+					Assert( m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject == NULL );
+					m_InternalData.Simulation.Static.World.Brushes.pPhysicsObject = m_IncrementalMove.pWorldBrushPhysicsObject;
+					m_IncrementalMove.pWorldBrushPhysicsObject = NULL;
+#endif
+				}
+			}
+			else
 			{
 				int *pBrushList = WorldBrushes.Base();
 				int iBrushCount = WorldBrushes.Count();
-				ConvertBrushListToClippedPolyhedronList( pBrushList, iBrushCount, fWorldClipPlane_Reverse, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.World.Brushes.Polyhedrons );
+				ConvertBrushListToClippedPolyhedronList( pBrushList, iBrushCount, fWorldClipPlane_Reverse, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.World.Brushes.Polyhedrons, &m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes );
 			}
 		}
 
@@ -1942,6 +2060,60 @@ void CPortalSimulator::CreatePolyhedrons( void )
 			{
 				ICollideable *pProp = StaticProps[i];
 
+				if( m_IncrementalMove.bActive )
+				{
+					//a prop that was already near the portal has the same clipped representation, collideable and physics object as before
+					IHandleEntity *pPropHandle = pProp->GetEntityHandle();
+					int iReusable;
+					for( iReusable = m_IncrementalMove.StaticPropRepresentations.Count(); --iReusable >= 0; )
+					{
+						if( m_IncrementalMove.StaticPropRepresentations[iReusable].pSourceProp == pPropHandle )
+							break;
+					}
+
+					if( iReusable >= 0 )
+					{
+						PS_SD_Static_World_StaticProps_ClippedProp_t &Reused = m_IncrementalMove.StaticPropRepresentations[iReusable];
+#ifdef _DEBUG
+						{
+							CPolyhedron *FreshPieces[1024];
+							int iFreshPieceCount = g_StaticCollisionPolyhedronCache.GetStaticPropPolyhedrons( pProp, FreshPieces, 1024 );
+							int iFreshClippedCount = 0;
+							for( int j = 0; j != iFreshPieceCount; ++j )
+							{
+								CPolyhedron *pFreshClipped = FreshPieces[j] ? ClipPolyhedron( FreshPieces[j], fWorldClipPlane_Reverse, 1, 0.01f, false ) : NULL;
+								if( pFreshClipped )
+								{
+									Assert( (iFreshClippedCount < Reused.PolyhedronGroup.iNumPolyhedrons) && 
+										PolyhedronsMatch( pFreshClipped, m_IncrementalMove.StaticPropPolyhedrons[Reused.PolyhedronGroup.iStartIndex + iFreshClippedCount] ) );
+									++iFreshClippedCount;
+									pFreshClipped->Release();
+								}
+							}
+							Assert( iFreshClippedCount == Reused.PolyhedronGroup.iNumPolyhedrons );
+						}
+#endif
+
+						int index = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.AddToTail( Reused );
+						PS_SD_Static_World_StaticProps_ClippedProp_t &NewEntry = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[index];
+						NewEntry.PolyhedronGroup.iStartIndex = m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count();
+
+						for( int j = 0; j != Reused.PolyhedronGroup.iNumPolyhedrons; ++j )
+						{
+							CPolyhedron *&pReusedPolyhedron = m_IncrementalMove.StaticPropPolyhedrons[Reused.PolyhedronGroup.iStartIndex + j];
+							m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.AddToTail( pReusedPolyhedron );
+							pReusedPolyhedron = NULL;
+						}
+
+						Reused.PolyhedronGroup.iNumPolyhedrons = 0;
+						Reused.pCollide = NULL;
+#ifndef CLIENT_DLL
+						Reused.pPhysicsObject = NULL;
+#endif
+						continue;
+					}
+				}
+
 				CPolyhedron *PolyhedronArray[1024];
 				int iPolyhedronCount = g_StaticCollisionPolyhedronCache.GetStaticPropPolyhedrons( pProp, PolyhedronArray, 1024 );
 
@@ -2218,6 +2390,8 @@ void CPortalSimulator::CreatePolyhedrons( void )
 		WallBrushPolyhedrons_ClippedToWall.RemoveAll();
 	}
 
+	ReleaseIncrementalMoveData();
+
 	STOPDEBUGTIMER( functionTimer );
 	DECREMENTTABSPACING();
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::CreatePolyhedrons() FINISH: %fms\n", GetPortalSimulatorGUID(), TABSPACING, functionTimer.GetDuration().GetMillisecondsF() ); );
@@ -2227,6 +2401,105 @@ void CPortalSimulator::CreatePolyhedrons( void )
 
 
 
+void CPortalSimulator::StashIncrementalMoveData( void )
+{
+	Assert( m_IncrementalMove.bActive == false );
+	ReleaseIncrementalMoveData();
+
+	PS_SD_Static_World_t &World = m_InternalData.Simulation.Static.World;
+
+	m_IncrementalMove.WorldBrushPolyhedrons.Swap( World.Brushes.Polyhedrons );
+	m_IncrementalMove.WorldBrushSources.Swap( World.Brushes.PolyhedronSourceBrushes );
+	m_IncrementalMove.pWorldBrushCollideable = World.Brushes.pCollideable;
+	World.Brushes.pCollideable = NULL;
+
+	m_IncrementalMove.StaticPropPolyhedrons.Swap( World.StaticProps.Polyhedrons );
+	m_IncrementalMove.StaticPropRepresentations.Swap( World.StaticProps.ClippedRepresentations );
+
+#ifndef CLIENT_DLL
+	m_IncrementalMove.pWorldBrushPhysicsObject = World.Brushes.pPhysicsObject;
+	World.Brushes.pPhysicsObject = NULL;
+	m_IncrementalMove.pPhysicsEnvironment = m_InternalData.Simulation.pPhysicsEnvironment;
+
+	if( !World.StaticProps.bPhysicsExists )
+	{
+		for( int i = m_IncrementalMove.StaticPropRepresentations.Count(); --i >= 0; )
+			Assert( m_IncrementalMove.StaticPropRepresentations[i].pPhysicsObject == NULL );
+	}
+#endif
+
+	m_IncrementalMove.bActive = true;
+}
+
+
+
+void CPortalSimulator::ReleaseIncrementalMoveData( void )
+{
+	if( m_IncrementalMove.bActive == false )
+		return;
+
+	for( int i = m_IncrementalMove.WorldBrushPolyhedrons.Count(); --i >= 0; )
+	{
+		if( m_IncrementalMove.WorldBrushPolyhedrons[i] )
+			m_IncrementalMove.WorldBrushPolyhedrons[i]->Release();
+	}
+	m_IncrementalMove.WorldBrushPolyhedrons.RemoveAll();
+	m_IncrementalMove.WorldBrushSources.RemoveAll();
+
+	for( int i = m_IncrementalMove.StaticPropPolyhedrons.Count(); --i >= 0; )
+	{
+		if( m_IncrementalMove.StaticPropPolyhedrons[i] )
+			m_IncrementalMove.StaticPropPolyhedrons[i]->Release();
+	}
+	m_IncrementalMove.StaticPropPolyhedrons.RemoveAll();
+
+#ifndef CLIENT_DLL
+	IPhysicsEnvironment *pEnvironment = m_IncrementalMove.pPhysicsEnvironment;
+	Assert( (pEnvironment != NULL) || (m_IncrementalMove.pWorldBrushPhysicsObject == NULL) );
+	if( pEnvironment )
+	{
+		pEnvironment->CleanupDeleteList();
+		pEnvironment->SetQuickDelete( true ); //same as ClearLocalPhysics(), if we don't do this, things crash the next time we cleanup the delete list while checking mindists
+
+		if( m_IncrementalMove.pWorldBrushPhysicsObject )
+			pEnvironment->DestroyObject( m_IncrementalMove.pWorldBrushPhysicsObject );
+
+		for( int i = m_IncrementalMove.StaticPropRepresentations.Count(); --i >= 0; )
+		{
+			PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_IncrementalMove.StaticPropRepresentations[i];
+			if( Representation.pPhysicsObject )
+			{
+				pEnvironment->DestroyObject( Representation.pPhysicsObject );
+				Representation.pPhysicsObject = NULL;
+			}
+		}
+
+		pEnvironment->CleanupDeleteList();
+		pEnvironment->SetQuickDelete( false );
+	}
+	m_IncrementalMove.pWorldBrushPhysicsObject = NULL;
+	m_IncrementalMove.pPhysicsEnvironment = NULL;
+#endif
+
+	for( int i = m_IncrementalMove.StaticPropRepresentations.Count(); --i >= 0; )
+	{
+		PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_IncrementalMove.StaticPropRepresentations[i];
+		if( Representation.pCollide )
+			s_PortalCollideCache.Release( Representation.pCollide );
+	}
+	m_IncrementalMove.StaticPropRepresentations.RemoveAll();
+
+	if( m_IncrementalMove.pWorldBrushCollideable )
+	{
+		s_PortalCollideCache.Release( m_IncrementalMove.pWorldBrushCollideable );
+		m_IncrementalMove.pWorldBrushCollideable = NULL;
+	}
+
+	m_IncrementalMove.bActive = false;
+}
+
+
+
 void CPortalSimulator::ClearPolyhedrons( void )
 {
 	if( m_CreationChecklist.bPolyhedronsGenerated == false )
@@ -2245,6 +2518,7 @@ void CPortalSimulator::ClearPolyhedrons( void )
 		
 		m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.RemoveAll();
 	}
+	m_InternalData.Simulation.Static.World.Brushes.PolyhedronSourceBrushes.RemoveAll();
 
 	if( m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count() != 0 )
 	{
@@ -2510,6 +2784,35 @@ CPortalSimulator *CPortalSimulator::GetSimulatorThatOwnsEntity( const CBaseEntit
 
 CPortalSimulator *CPortalSimulator::GetSimulatorThatCreatedPhysicsObject( const IPhysicsObject *pObject, PS_PhysicsObjectSourceType_t *pOut_SourceType )
 {
+	//Everything a simulator creates is tied to its collision entity, so the game data points straight at the only simulator that could own it.
+	//Only objects tied to the world (simulators that failed to create a collision entity) need the full search.
+	CBaseEntity *pGameData = (CBaseEntity *)pObject->GetGameData();
+	if( (pGameData != NULL) && !pGameData->IsWorld() )
+	{
+		CPortalSimulator *pSimulator = NULL;
+		if( CPSCollisionEntity::IsPortalSimulatorCollisionEntity( pGameData ) )
+		{
+			pSimulator = ((CPSCollisionEntity *)pGameData)->m_pOwningSimulator;
+			if( (pSimulator != NULL) && !pSimulator->CreatedPhysicsObject( pObject, pOut_SourceType ) )
+				pSimulator = NULL;
+		}
+
+#ifdef _DEBUG
+		CPortalSimulator *pSimulatorCheck = NULL;
+		for( int i = s_PortalSimulators.Count(); --i >= 0; )
+		{
+			if( s_PortalSimulators[i]->CreatedPhysicsObject( pObject ) )
+			{
+				pSimulatorCheck = s_PortalSimulators[i];
+				break;
+			}
+		}
+		AssertMsg( pSimulatorCheck == pSimulator, "Portal simulator physics object not tied to its simulator's collision entity." );
+#endif
+
+		return pSimulator;
+	}
+
 	for( int i = s_PortalSimulators.Count(); --i >= 0; )
 	{
 		if( s_PortalSimulators[i]->CreatedPhysicsObject( pObject, pOut_SourceType ) )
@@ -2577,7 +2880,7 @@ bool CPortalSimulator::CreatedPhysicsObject( const IPhysicsObject *pObject, PS_P
 
 
 
-static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList )
+static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList, CUtlVector<int> *pSourceBrushList )
 {
 	if( pPolyhedronList == NULL )
 		return;
@@ -2589,7 +2892,11 @@ static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iB
 	{
 		CPolyhedron *pPolyhedron = ClipPolyhedron( g_StaticCollisionPolyhedronCache.GetBrushPolyhedron( pBrushes[i] ), pOutwardFacingClipPlanes, iClipPlaneCount, fClipEpsilon );
 		if( pPolyhedron )
+		{
 			pPolyhedronList->AddToTail( pPolyhedron );
+			if( pSourceBrushList )
+				pSourceBrushList->AddToTail( pBrushes[i] );
+		}
 	}
 }
 
@@ -2609,6 +2916,27 @@ static void ClipPolyhedrons( CPolyhedron * const *pExistingPolyhedrons, int iPol
 	}
 }
 
+#ifdef _DEBUG
+static bool PolyhedronsMatch( const CPolyhedron *pPolyhedron1, const CPolyhedron *pPolyhedron2 )
+{
+	if( (pPolyhedron1 == NULL) || (pPolyhedron2 == NULL) )
+		return pPolyhedron1 == pPolyhedron2;
+
+	if( (pPolyhedron1->iVertexCount != pPolyhedron2->iVertexCount) ||
+		(pPolyhedron1->iLineCount != pPolyhedron2->iLineCount) ||
+		(pPolyhedron1->iPolygonCount != pPolyhedron2->iPolygonCount) )
+		return false;
+
+	for( int i = 0; i != pPolyhedron1->iVertexCount; ++i )
+	{
+		if( !VectorsAreEqual( pPolyhedron1->pVertices[i], pPolyhedron2->pVertices[i], 0.01f ) )
+			return false;
+	}
+
+	return true;
+}
+#endif
+
 static CPhysCollide *ConvertPolyhedronsToCollideable( CPolyhedron **pPolyhedrons, int iPolyhedronCount )
 {
 	if( (pPolyhedrons == NULL) || (iPolyhedronCount == 0 ) )
@@ -2660,6 +2988,167 @@ static CPhysCollide *ConvertPolyhedronsToCollideable( CPolyhedron **pPolyhedrons
 }
 
 
+CPhysCollide *CPortalCollideCache::Acquire( CPolyhedron **pPolyhedrons, int iPolyhedronCount )
+{
+	if( (pPolyhedrons == NULL) || (iPolyhedronCount == 0) )
+		return NULL;
+
+	if( sv_portal_collide_cache_size.GetInt() <= 0 )
+		return ConvertPolyhedronsToCollideable( pPolyhedrons, iPolyhedronCount );
+
+	CRC32_t key;
+	int iVertexCount = 0;
+	CRC32_Init( &key );
+	for( int i = 0; i != iPolyhedronCount; ++i )
+	{
+		const CPolyhedron *pPolyhedron = pPolyhedrons[i];
+		iVertexCount += pPolyhedron->iVertexCount;
+		CRC32_ProcessBuffer( &key, pPolyhedron->pVertices, pPolyhedron->iVertexCount * sizeof( Vector ) );
+		CRC32_ProcessBuffer( &key, pPolyhedron->pLines, pPolyhedron->iLineCount * sizeof( Polyhedron_IndexedLine_t ) );
+
+		//field by field, Polyhedron_IndexedLineReference_t has padding
+		for( int j = 0; j != pPolyhedron->iIndexCount; ++j )
+		{
+			CRC32_ProcessBuffer( &key, &pPolyhedron->pIndices[j].iLineIndex, sizeof( pPolyhedron->pIndices[j].iLineIndex ) );
+			CRC32_ProcessBuffer( &key, &pPolyhedron->pIndices[j].iEndPointIndex, sizeof( pPolyhedron->pIndices[j].iEndPointIndex ) );
+		}
+
+		for( int j = 0; j != pPolyhedron->iPolygonCount; ++j )
+		{
+			const Polyhedron_IndexedPolygon_t &polygon = pPolyhedron->pPolygons[j];
+			CRC32_ProcessBuffer( &key, &polygon.iFirstIndex, sizeof( polygon.iFirstIndex ) );
+			CRC32_ProcessBuffer( &key, &polygon.iIndexCount, sizeof( polygon.iIndexCount ) );
+			CRC32_ProcessBuffer( &key, &polygon.polyNormal, sizeof( polygon.polyNormal ) );
+		}
+	}
+	CRC32_Final( &key );
+
+	for( int i = m_Entries.Count(); --i >= 0; )
+	{
+		Entry_t &entry = m_Entries[i];
+		if( (entry.key == key) && (entry.iPolyhedronCount == iPolyhedronCount) && (entry.iVertexCount == iVertexCount) &&
+			EntryMatches( entry, pPolyhedrons, iPolyhedronCount ) ) //a CRC collision would hand out the wrong shape
+		{
+			++entry.iRefCount;
+			entry.iLastUsed = ++m_iUseCounter;
+			return entry.pCollide;
+		}
+	}
+
+	CPhysCollide *pCollide = ConvertPolyhedronsToCollideable( pPolyhedrons, iPolyhedronCount );
+	if( pCollide == NULL )
+		return NULL;
+
+	int index = m_Entries.AddToTail();
+	Entry_t &entry = m_Entries[index];
+	entry.key = key;
+	entry.iPolyhedronCount = iPolyhedronCount;
+	entry.iVertexCount = iVertexCount;
+	entry.pVertices = new Vector [iVertexCount];
+	entry.pPolyhedronVertexCounts = new unsigned short [iPolyhedronCount];
+	{
+		Vector *pWriteVertices = entry.pVertices;
+		for( int i = 0; i != iPolyhedronCount; ++i )
+		{
+			memcpy( pWriteVertices, pPolyhedrons[i]->pVertices, pPolyhedrons[i]->iVertexCount * sizeof( Vector ) );
+			pWriteVertices += pPolyhedrons[i]->iVertexCount;
+			entry.pPolyhedronVertexCounts[i] = pPolyhedrons[i]->iVertexCount;
+		}
+	}
+	entry.pCollide = pCollide;
+	entry.iRefCount = 1;
+	entry.iLastUsed = ++m_iUseCounter;
+
+	return pCollide;
+}
+
+bool CPortalCollideCache::EntryMatches( const Entry_t &entry, CPolyhedron **pPolyhedrons, int iPolyhedronCount )
+{
+	const Vector *pReadVertices = entry.pVertices;
+	for( int i = 0; i != iPolyhedronCount; ++i )
+	{
+		const CPolyhedron *pPolyhedron = pPolyhedrons[i];
+		if( pPolyhedron->iVertexCount != entry.pPolyhedronVertexCounts[i] )
+			return false;
+
+		if( memcmp( pReadVertices, pPolyhedron->pVertices, pPolyhedron->iVertexCount * sizeof( Vector ) ) != 0 )
+			return false;
+
+		pReadVertices += pPolyhedron->iVertexCount;
+	}
+
+	return true;
+}
+
+void CPortalCollideCache::DestroyEntry( Entry_t &entry )
+{
+	physcollision->DestroyCollide( entry.pCollide );
+	delete []entry.pVertices;
+	delete []entry.pPolyhedronVertexCounts;
+	entry.pCollide = NULL;
+	entry.pVertices = NULL;
+	entry.pPolyhedronVertexCounts = NULL;
+}
+
+void CPortalCollideCache::Release( CPhysCollide *pCollide )
+{
+	if( pCollide == NULL )
+		return;
+
+	for( int i = m_Entries.Count(); --i >= 0; )
+	{
+		Entry_t &entry = m_Entries[i];
+		if( entry.pCollide == pCollide )
+		{
+			Assert( entry.iRefCount > 0 );
+			--entry.iRefCount;
+			if( entry.iRefCount == 0 )
+				EvictUnused( MAX( sv_portal_collide_cache_size.GetInt(), 0 ) );
+
+			return;
+		}
+	}
+
+	//built while the cache was disabled
+	physcollision->DestroyCollide( pCollide );
+}
+
+void CPortalCollideCache::EvictUnused( int iMaxUnused )
+{
+	for( ;; )
+	{
+		int iUnusedCount = 0;
+		int iOldest = -1;
+		for( int i = m_Entries.Count(); --i >= 0; )
+		{
+			if( m_Entries[i].iRefCount != 0 )
+				continue;
+
+			++iUnusedCount;
+			if( (iOldest == -1) || (m_Entries[i].iLastUsed < m_Entries[iOldest].iLastUsed) )
+				iOldest = i;
+		}
+
+		if( iUnusedCount <= iMaxUnused )
+			return;
+
+		DestroyEntry( m_Entries[iOldest] );
+		m_Entries.FastRemove( iOldest );
+	}
+}
+
+void CPortalCollideCache::Flush( void )
+{
+	for( int i = m_Entries.Count(); --i >= 0; )
+	{
+		AssertMsg( m_Entries[i].iRefCount == 0, "Portal collideable still in use at level shutdown" );
+		DestroyEntry( m_Entries[i] );
+	}
+	m_Entries.RemoveAll();
+	m_iUseCounter = 0;
+}
+
+
 static inline CPolyhedron *TransformAndClipSinglePolyhedron( CPolyhedron *pExistingPolyhedron, const VMatrix &Transform, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fCutEpsilon, bool bUseTempMemory )
 {
 	Vector *pTempPointArray = (Vector *)stackalloc( sizeof( Vector ) * pExistingPolyhedron->iVertexCount );
@@ -2817,6 +3306,11 @@ public:
 			s_PortalSimulators[i]->ClearEverything();
 	}
 
+	virtual void LevelShutdownPostEntity( void )
+	{
+		s_PortalCollideCache.Flush();
+	}
+
 #ifndef CLIENT_DLL
 	virtual bool Init( void )
 	{
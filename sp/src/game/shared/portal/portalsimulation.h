@@ -114,6 +114,7 @@ struct PS_PlacementData_t //stuff useful for geometric operations
 struct PS_SD_Static_World_Brushes_t
 {
 	CUtlVector<CPolyhedron *> Polyhedrons; //the building blocks of more complex collision
+	CUtlVector<int> PolyhedronSourceBrushes; //brush index each entry in Polyhedrons was clipped from
 	CPhysCollide *pCollideable;
 #ifndef CLIENT_DLL
 	IPhysicsObject *pPhysicsObject;
@@ -346,6 +347,20 @@ protected:
 	int					m_iPortalSimulatorGUID;
 #endif
 
+	struct PS_IncrementalMoveData_t //world collision from the previous placement that's still valid when moving along the same plane, see MoveTo()
+	{
+		bool			bActive;
+		CUtlVector<CPolyhedron *> WorldBrushPolyhedrons;
+		CUtlVector<int> WorldBrushSources;
+		CPhysCollide	*pWorldBrushCollideable;
+		CUtlVector<CPolyhedron *> StaticPropPolyhedrons;
+		CUtlVector<PS_SD_Static_World_StaticProps_ClippedProp_t> StaticPropRepresentations;
+#ifndef CLIENT_DLL
+		IPhysicsObject	*pWorldBrushPhysicsObject;
+		IPhysicsEnvironment *pPhysicsEnvironment;
+#endif
+	} m_IncrementalMove;
+
 	struct
 	{
 		bool			bPolyhedronsGenerated;
@@ -385,6 +400,9 @@ protected:
 	void				CreatePolyhedrons( void ); //carves up the world around the portal's position into sets of polyhedrons
 	void				ClearPolyhedrons( void );
 
+	void				StashIncrementalMoveData( void ); //moves reusable world collision out of the way of the Clear*() functions
+	void				ReleaseIncrementalMoveData( void ); //frees whatever CreatePolyhedrons() didn't pick back up
+
 	void				UpdateLinkMatrix( void );
 
 	void				MarkAsOwned( CBaseEntity *pEntity );
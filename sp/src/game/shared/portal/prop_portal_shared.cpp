@@ -8,6 +8,8 @@
 #include "cbase.h"
 #include "prop_portal_shared.h"
 #include "portal_shareddefs.h"
+#include "portal_util_shared.h"
+#include "collisionutils.h"
 
 #ifdef CLIENT_DLL
 #include "c_basedoor.h"
@@ -18,6 +20,116 @@ CUtlVector<CProp_Portal *> CProp_Portal_Shared::AllPortals;
 const Vector CProp_Portal_Shared::vLocalMins( 0.0f, -PORTAL_HALF_WIDTH, -PORTAL_HALF_HEIGHT );
 const Vector CProp_Portal_Shared::vLocalMaxs( 64.0f, PORTAL_HALF_WIDTH, PORTAL_HALF_HEIGHT );
 
+ConVar sv_portal_trace_spatial_index( "sv_portal_trace_spatial_index", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Reject portals with a cached bounding box test before doing full ray vs portal intersections. 0 tests every active portal." );
+
+struct PortalSpatialIndexEntry_t
+{
+	CProp_Portal *pPortal;
+	Vector vMins, vMaxs;
+	Vector ptOrigin; //transform the bounds were built from, so a portal that moved without telling us is caught at query time
+	QAngle qAngles;
+	bool bBoundsValid;
+};
+
+//kept in the same order as AllPortals so closest-portal ties resolve the same way they always have
+static CUtlVector<PortalSpatialIndexEntry_t> s_PortalSpatialIndex;
+
+static struct PortalSpatialIndexStats_t
+{
+	unsigned int iQueries;
+	unsigned int iPortalsConsidered; //active and linked portals looked at
+	unsigned int iCandidates; //portals that made it past the bounds test and went on to a real intersection test
+} s_PortalSpatialIndexStats = { 0, 0, 0 };
+
+static void RebuildSpatialIndexEntry( PortalSpatialIndexEntry_t &entry )
+{
+	entry.ptOrigin = entry.pPortal->GetAbsOrigin();
+	entry.qAngles = entry.pPortal->GetAbsAngles();
+	UTIL_Portal_AABB( entry.pPortal, entry.vMins, entry.vMaxs );
+	entry.bBoundsValid = true;
+}
+
+void CProp_Portal_Shared::AddToSpatialIndex( CProp_Portal *pPortal )
+{
+	PortalSpatialIndexEntry_t &entry = s_PortalSpatialIndex[s_PortalSpatialIndex.AddToTail()];
+	entry.pPortal = pPortal;
+	entry.bBoundsValid = false; //the entity isn't positioned yet
+}
+
+void CProp_Portal_Shared::RemoveFromSpatialIndex( CProp_Portal *pPortal )
+{
+	for( int i = 0; i != s_PortalSpatialIndex.Count(); ++i )
+	{
+		if( s_PortalSpatialIndex[i].pPortal == pPortal )
+		{
+			s_PortalSpatialIndex.Remove( i );
+			return;
+		}
+	}
+}
+
+void CProp_Portal_Shared::UpdateSpatialIndex( CProp_Portal *pPortal )
+{
+	for( int i = 0; i != s_PortalSpatialIndex.Count(); ++i )
+	{
+		if( s_PortalSpatialIndex[i].pPortal == pPortal )
+		{
+			RebuildSpatialIndexEntry( s_PortalSpatialIndex[i] );
+			return;
+		}
+	}
+}
+
+int CProp_Portal_Shared::GetPortalsAlongRay( const Ray_t &ray, CProp_Portal **pPortalsOut, int iMaxPortals )
+{
+	++s_PortalSpatialIndexStats.iQueries;
+
+	bool bUseBounds = sv_portal_trace_spatial_index.GetBool();
+	int iCount = 0;
+	
+	for( int i = 0; (i != s_PortalSpatialIndex.Count()) && (iCount != iMaxPortals); ++i )
+	{
+		PortalSpatialIndexEntry_t &entry = s_PortalSpatialIndex[i];
+		CProp_Portal *pPortal = entry.pPortal;
+		if( !pPortal->IsActivedAndLinked() )
+			continue;
+
+		++s_PortalSpatialIndexStats.iPortalsConsidered;
+
+		if( bUseBounds )
+		{
+			if( !entry.bBoundsValid || 
+				(entry.ptOrigin != pPortal->GetAbsOrigin()) ||
+				(entry.qAngles != pPortal->GetAbsAngles()) )
+			{
+				RebuildSpatialIndexEntry( entry );
+			}
+
+			if( !IsBoxIntersectingRay( entry.vMins, entry.vMaxs, ray, 1.0f ) )
+				continue;
+		}
+
+		pPortalsOut[iCount] = pPortal;
+		++iCount;
+	}
+
+	s_PortalSpatialIndexStats.iCandidates += iCount;
+	return iCount;
+}
+
+#ifdef CLIENT_DLL
+CON_COMMAND_F( cl_portal_trace_spatial_index_stats, "Print and reset client portal ray query counters.", FCVAR_CHEAT )
+#else
+CON_COMMAND_F( sv_portal_trace_spatial_index_stats, "Print and reset server portal ray query counters.", FCVAR_CHEAT )
+#endif
+{
+	Msg( "%u portal ray queries, %u active portals considered, %u full intersection tests (%.1f%% rejected by bounds)\n",
+		s_PortalSpatialIndexStats.iQueries, s_PortalSpatialIndexStats.iPortalsConsidered, s_PortalSpatialIndexStats.iCandidates,
+		(s_PortalSpatialIndexStats.iPortalsConsidered != 0) ? (100.0f * (float)(s_PortalSpatialIndexStats.iPortalsConsidered - s_PortalSpatialIndexStats.iCandidates) / (float)s_PortalSpatialIndexStats.iPortalsConsidered) : 0.0f );
+
+	memset( &s_PortalSpatialIndexStats, 0, sizeof( s_PortalSpatialIndexStats ) );
+}
+
 void CProp_Portal_Shared::UpdatePortalTransformationMatrix( const matrix3x4_t &localToWorld, const matrix3x4_t &remoteToWorld, VMatrix *pMatrix )
 {
 	VMatrix matPortal1ToWorldInv, matPortal2ToWorld, matRotation;
@@ -40,6 +40,14 @@ public:
 #else
 	static CUtlVector<CProp_Portal *> AllPortals; //an array of existing portal entities
 #endif //#ifdef CLIENT_DLL
+
+	//world space bounds of every portal, so per-ray queries can reject far away portals with a box test instead of a full portal intersection
+	static void AddToSpatialIndex( CProp_Portal *pPortal );
+	static void RemoveFromSpatialIndex( CProp_Portal *pPortal );
+	static void UpdateSpatialIndex( CProp_Portal *pPortal ); //call when a portal moves or changes activation state
+
+	//fills pPortalsOut with active and linked portals whose bounds the ray touches, in AllPortals order. Returns the number written.
+	static int GetPortalsAlongRay( const Ray_t &ray, CProp_Portal **pPortalsOut, int iMaxPortals );
 };
 
 
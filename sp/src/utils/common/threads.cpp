@@ -19,7 +19,15 @@
 #include "threads.h"
 #include "pacifier.h"
 
-#define	MAX_THREADS	16
+#define	MAX_THREADS	MAX_TOOL_THREADS
+
+// RunThreadsOnIndividual hands out work in chunks of
+// remaining / (numthreads * THREAD_WORK_CHUNK_DIVISOR) items, so chunks start big
+// and shrink to single items near the end of the pass where the expensive
+// (sorted last) items usually are. THREAD_WORK_MAX_CHUNK keeps one thread from
+// swallowing a long run of items early on.
+#define THREAD_WORK_CHUNK_DIVISOR	4
+#define THREAD_WORK_MAX_CHUNK		64
 
 
 class CRunThreadsData
@@ -33,10 +41,14 @@ public:
 CRunThreadsData g_RunThreadsData[MAX_THREADS];
 
 
-int		dispatch;
+volatile LONG	dispatch;
 int		workcount;
 qboolean		pacifier;
 
+// Only one thread draws the pacifier at a time; the others skip the update.
+CRITICAL_SECTION	g_PacifierCrit;
+volatile LONG		g_iPacifierLastDrawn;
+
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
@@ -50,25 +62,67 @@ GetThreadWork
 
 =============
 */
-int	GetThreadWork (void)
+static void UpdateThreadWorkPacifier( int iDispatched )
 {
-	int	r;
+	// Cheap early out so the pacifier lock is only touched when a new dot is due.
+	int iCur = (int)( 40.0f * iDispatched / workcount );
+	if ( iCur <= g_iPacifierLastDrawn )
+		return;
+
+	if ( !threaded )
+	{
+		g_iPacifierLastDrawn = iCur;
+		UpdatePacifier( (float)iDispatched / workcount );
+		return;
+	}
 
-	ThreadLock ();
+	// Whoever is already drawing will catch up on the next update.
+	if ( !TryEnterCriticalSection( &g_PacifierCrit ) )
+		return;
 
-	if (dispatch == workcount)
+	if ( iCur > g_iPacifierLastDrawn )
 	{
-		ThreadUnlock ();
-		return -1;
+		g_iPacifierLastDrawn = iCur;
+		UpdatePacifier( (float)iDispatched / workcount );
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	LeaveCriticalSection( &g_PacifierCrit );
+}
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
 
-	return r;
+// Claims [iStart, iEnd) from the shared work counter without taking ThreadLock.
+// Returns false when the pass is out of work.
+static bool GetThreadWorkChunk( int nMaxChunk, int &iStart, int &iEnd )
+{
+	int nChunk = 1;
+	if ( nMaxChunk > 1 )
+	{
+		int nRemaining = workcount - dispatch;
+		if ( nRemaining <= 0 )
+			return false;
+
+		nChunk = nRemaining / ( max( numthreads, 1 ) * THREAD_WORK_CHUNK_DIVISOR );
+		nChunk = Clamp( nChunk, 1, nMaxChunk );
+	}
+
+	// dispatch can run past workcount when several threads race for the tail; that's harmless.
+	iStart = InterlockedExchangeAdd( &dispatch, nChunk );
+	if ( iStart >= workcount )
+		return false;
+
+	iEnd = min( iStart + nChunk, workcount );
+	UpdateThreadWorkPacifier( iStart );
+	return true;
+}
+
+
+int	GetThreadWork (void)
+{
+	int iStart, iEnd;
+	if ( !GetThreadWorkChunk( 1, iStart, iEnd ) )
+		return -1;
+
+	return iStart;
 }
 
 
@@ -76,15 +130,13 @@ ThreadWorkerFn workfunction;
 
 void ThreadWorkerFunction( int iThread, void *pUserData )
 {
-	int		work;
-
-	while (1)
+	int iStart, iEnd;
+	while ( GetThreadWorkChunk( THREAD_WORK_MAX_CHUNK, iStart, iEnd ) )
 	{
-		work = GetThreadWork ();
-		if (work == -1)
-			break;
-		 
-		workfunction( iThread, work );
+		for ( int work = iStart; work < iEnd; work++ )
+		{
+			workfunction( iThread, work );
+		}
 	}
 }
 
@@ -117,6 +169,7 @@ public:
 	CCritInit()
 	{
 		InitializeCriticalSection (&crit);
+		InitializeCriticalSection (&g_PacifierCrit);
 	}
 } g_CritInit;
 
@@ -136,8 +189,10 @@ void ThreadSetDefault (void)
 	{
 		GetSystemInfo (&info);
 		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+		if (numthreads < 1)
 			numthreads = 1;
+		else if (numthreads > MAX_TOOL_THREADS)
+			numthreads = MAX_TOOL_THREADS;
 	}
 
 	Msg ("%i threads\n", numthreads);
@@ -232,6 +287,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	start = Plat_FloatTime();
 	dispatch = 0;
 	workcount = workcnt;
+	g_iPacifierLastDrawn = 0;
 	StartPacifier("");
 	pacifier = showpacifier;
 
@@ -22,6 +22,7 @@
 #include "mathlib/quantize.h"
 #include "bitmap/imageformat.h"
 #include "coordsize.h"
+#include "tier0/fasttimer.h"
 
 enum
 {
@@ -2486,80 +2487,163 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 }
 
 //-----------------------------------------------------------------------------
-// Iterates over all lights and computes lighting at up to 4 sample points
+// Sample positions, normals and clusters for one group of 4 samples, kept for
+// the whole face so the lights can be gathered one at a time
 //-----------------------------------------------------------------------------
-static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+struct SSE_SampleGroup_t
 {
-	SSE_sampleLightOutput_t out;
+	int			m_NumSamples;
+	int			m_Clusters[4];
+	FourVectors	m_Points;
+	FourVectors	m_PointNormals[ NUM_BUMP_VECTS + 1 ];
+};
 
-	// Iterate over all direct lights and add them to the particular sample
-	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
-	{	    
-		// is this lights cluster visible?
-		fltx4 dotMask = Four_Zeros;
-		bool skipLight = true;
-		for( int s = 0; s < numSamples; s++ )
+typedef CUtlVector< SSE_SampleGroup_t, CUtlMemoryAligned< SSE_SampleGroup_t, 16 > > SampleGroupVector_t;
+static SampleGroupVector_t s_SampleGroups[MAX_TOOL_THREADS+1];
+
+// Per thread so BuildFacelights never has to lock; summed in PrintDirectLightTimes
+struct DirectLightTime_t
+{
+	CCycleCount	m_Time;
+	int64		m_nSamples;
+	int			m_nLightFaces;
+};
+
+#define NUM_EMIT_TYPES	( emit_skyambient + 1 )
+static DirectLightTime_t s_DirectLightTimes[MAX_TOOL_THREADS+1][NUM_EMIT_TYPES];
+
+void PrintDirectLightTimes()
+{
+	static const char *s_pEmitTypeNames[NUM_EMIT_TYPES] = { "surface", "point", "spotlight", "skylight", "quakelight", "skyambient" };
+
+	qprintf( "Direct lighting by light type (summed over threads):\n" );
+	for ( int nType = 0; nType < NUM_EMIT_TYPES; nType++ )
+	{
+		CCycleCount time;
+		int64 nSamples = 0;
+		int nLightFaces = 0;
+		for ( int i = 0; i < MAX_TOOL_THREADS+1; i++ )
 		{
-			if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
-			{
-				dotMask = SetComponentSIMD( dotMask, s, 1.0f );
-				skipLight = false;
-			}
+			time += s_DirectLightTimes[i][nType].m_Time;
+			nSamples += s_DirectLightTimes[i][nType].m_nSamples;
+			nLightFaces += s_DirectLightTimes[i][nType].m_nLightFaces;
 		}
-		if ( skipLight )
+
+		if ( !nLightFaces )
 			continue;
 
-		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-		
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+		qprintf( "  %-12s %10.2f s  %9d light/face pairs  %12lld samples\n",
+			s_pEmitTypeNames[nType], time.GetMillisecondsF() / 1000.0, nLightFaces, nSamples );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Computes lighting from one light at up to 4 sample points
+// Returns the number of samples that had to be lit (0 if the light was culled)
+//-----------------------------------------------------------------------------
+static int GatherSampleLightAt4Points( SSE_SampleInfo_t& info, directlight_t *dl, SSE_SampleGroup_t &group, int sampleIdx )
+{
+	SSE_sampleLightOutput_t out;
+	int numSamples = group.m_NumSamples;
+
+	// is this lights cluster visible?
+	fltx4 dotMask = Four_Zeros;
+	bool skipLight = true;
+	for( int s = 0; s < numSamples; s++ )
+	{
+		if( PVSCheck( dl->pvs, group.m_Clusters[s] ) )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
+			dotMask = SetComponentSIMD( dotMask, s, 1.0f );
+			skipLight = false;
 		}
-		if ( skipLight )
-			continue;
+	}
+	if ( skipLight )
+		return 0;
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+	GatherSampleLightSSE( out, dl, info.m_FaceNum, group.m_Points, group.m_PointNormals, info.m_NormalCount, info.m_iThread );
+	
+	// Apply the PVS check filter and compute falloff x dot
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
-			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
-			}
-			continue;
+			skipLight = false;
 		}
+	}
+	if ( skipLight )
+		return numSamples;
 
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
+		{
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				group.m_Points.x.m128_f32[0], group.m_Points.y.m128_f32[0], group.m_Points.z.m128_f32[0] );
+			info.m_WarnFace = info.m_FaceNum;
+		}
+		return numSamples;
+	}
 
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
-			}
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
 		}
+	}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
-			}
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
+		}
+	}
+
+	return numSamples;
+}
+
+//-----------------------------------------------------------------------------
+// Iterates over all lights and adds them to every sample group on the face.
+// Going light by light keeps consecutive shadow rays heading for the same light
+// from neighboring samples, which walk the same part of the kd-tree.
+//-----------------------------------------------------------------------------
+static void GatherSampleLightForFace( SSE_SampleInfo_t& info, SampleGroupVector_t &groups )
+{
+	DirectLightTime_t *pTimes = s_DirectLightTimes[info.m_iThread];
+
+	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
+	{
+		CFastTimer timer;
+		timer.Start();
+
+		int nSamples = 0;
+		for ( int grp = 0; grp < groups.Count(); ++grp )
+		{
+			nSamples += GatherSampleLightAt4Points( info, dl, groups[grp], 4 * grp );
+		}
+
+		timer.End();
+
+		if ( nSamples )
+		{
+			DirectLightTime_t &times = pTimes[dl->light.type];
+			times.m_Time += timer.GetDuration();
+			times.m_nSamples += nSamples;
+			times.m_nLightFaces++;
 		}
 	}
 }
@@ -3113,7 +3197,10 @@ void BuildFacelights (int iThread, int facenum)
 	f->styles[0] = 0;
 	AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
 
-	// sample the lights at each sample location
+	SampleGroupVector_t &groups = s_SampleGroups[iThread];
+	groups.SetCount( numGroups );
+
+	// find the sample locations
 	for ( int grp = 0; grp < numGroups; ++grp )
 	{
 		int nSample = 4 * grp;
@@ -3141,9 +3228,17 @@ void BuildFacelights (int iThread, int facenum)
 				sample[i].normal = sampleInfo.m_PointNormals[0].Vec( i );
 		}
 
-		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		SSE_SampleGroup_t &group = groups[grp];
+		group.m_NumSamples = numSamples;
+		group.m_Points = sampleInfo.m_Points;
+		for ( int i = 0; i < sampleInfo.m_NormalCount; i++ )
+			group.m_PointNormals[i] = sampleInfo.m_PointNormals[i];
+		for ( int i = 0; i < 4; i++ )
+			group.m_Clusters[i] = sampleInfo.m_Clusters[i];
 	}
+
+	// Iterate over all the lights and add their contribution to every group of spots
+	GatherSampleLightForFace( sampleInfo, groups );
 	
 	// Tell the incremental light manager that we're done with this face.
 	if( g_pIncremental )
@@ -135,6 +135,8 @@ extern void InitLightinfo( lightinfo_t *l, int facenum );
 
 void FreeDLights();
 
+void PrintDirectLightTimes();
+
 void ExportDirectLightsToWorldLights();
 
 
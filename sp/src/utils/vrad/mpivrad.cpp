@@ -38,6 +38,7 @@ CUtlVector<char> g_LightResultsFilename;
 
 extern int total_transfer;
 extern int max_transfer;
+extern int64 g_nCompactTransferBytes;
 
 extern void BuildVisLeafs(int);
 extern void BuildPatchLights( int facenum );
@@ -296,6 +297,14 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		{
 			patch->transfers = new transfer_t[numtransfers];
 			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+
+			// Workers send plain lists, compact them here so the master never holds them all.
+			if ( g_bCompactTransfers )
+			{
+				transfer_t *pTransfers = patch->transfers;
+				g_nCompactTransferBytes += CompactPatchTransfers( patch, pTransfers, numtransfers );
+				delete [] pTransfers;
+			}
 		}
 		
 		total_transfer += numtransfers;
@@ -59,6 +59,7 @@ bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
+bool		g_bCompactTransfers = false;
 bool        g_bNoSkyRecurse = false;
 
 int			junk;
@@ -1056,6 +1057,7 @@ MakeScales
 */
 int	total_transfer;
 int max_transfer;
+int64 g_nCompactTransferBytes;
 
 
 //-----------------------------------------------------------------------------
@@ -1209,6 +1211,9 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		return;
 	CPatch *patch = &g_Patches.Element( ndxPatch );
 
+	int nTransfers = patch->numtransfers;
+	int nCompactBytes = 0;
+
 	// copy the transfers out
 	if (patch->numtransfers)
 	{
@@ -1218,10 +1223,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		}
 
 
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1237,16 +1238,30 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		// VMPI workers always send plain transfer_t lists, the master compacts them as they arrive
+		if ( g_bCompactTransfers && !g_bUseMPI )
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			t2 = all_transfers;
+			for (j=0 ; j<nTransfers ; j++, t2++)
+			{
+				t2->transfer *= total;
+			}
+
+			nCompactBytes = CompactPatchTransfers( patch, all_transfers, nTransfers );
 		}
-		if (patch->numtransfers > max_transfer)
+		else
 		{
-			max_transfer = patch->numtransfers;
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
 		}
 	}
 	else
@@ -1256,10 +1271,76 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 	}
 
 	ThreadLock ();
-	total_transfer += patch->numtransfers;
+	total_transfer += nTransfers;
+	g_nCompactTransferBytes += nCompactBytes;
 	ThreadUnlock ();
 }
 
+
+static int TransferPatchCompare( const void *a, const void *b )
+{
+	return ((const transfer_t *)a)->patch - ((const transfer_t *)b)->patch;
+}
+
+#define COMPACT_TRANSFER_MAX_DELTA	0xFFFF
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces a patch's transfer list (already scaled by MakeScales) with
+//			patch index deltas and transfers quantized against the largest one,
+//			4 bytes per transfer instead of 8. Deltas that don't fit in 16 bits
+//			are bridged with zero transfers. Sorts pTransfers.
+// Output : bytes allocated for the patch
+//-----------------------------------------------------------------------------
+int CompactPatchTransfers( CPatch *patch, transfer_t *pTransfers, int nTransfers )
+{
+	qsort( pTransfers, nTransfers, sizeof( transfer_t ), TransferPatchCompare );
+
+	int nCompact = 0;
+	int ndxPrev = 0;
+	float flMax = 0.0f;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		int nDelta = pTransfers[i].patch - ndxPrev;
+		nCompact += 1 + ( ( nDelta > COMPACT_TRANSFER_MAX_DELTA ) ? ( nDelta - 1 ) / COMPACT_TRANSFER_MAX_DELTA : 0 );
+		ndxPrev = pTransfers[i].patch;
+		if ( pTransfers[i].transfer > flMax )
+			flMax = pTransfers[i].transfer;
+	}
+
+	int nBytes = nCompact * 2 * sizeof( unsigned short );
+	unsigned short *pCompact = (unsigned short *)malloc( nBytes );
+	if ( !pCompact )
+		Error ("Memory allocation failure");
+
+	unsigned short *pDelta = pCompact;
+	unsigned short *pQuant = pCompact + nCompact;
+	float flQuantize = ( flMax > 0.0f ) ? 65535.0f / flMax : 0.0f;
+
+	ndxPrev = 0;
+	for ( int i = 0; i < nTransfers; i++ )
+	{
+		int nDelta = pTransfers[i].patch - ndxPrev;
+		while ( nDelta > COMPACT_TRANSFER_MAX_DELTA )
+		{
+			*pDelta++ = COMPACT_TRANSFER_MAX_DELTA;
+			*pQuant++ = 0;
+			nDelta -= COMPACT_TRANSFER_MAX_DELTA;
+		}
+
+		*pDelta++ = (unsigned short)nDelta;
+		*pQuant++ = (unsigned short)( pTransfers[i].transfer * flQuantize + 0.5f );
+		ndxPrev = pTransfers[i].patch;
+	}
+	Assert( pDelta == pCompact + nCompact );
+
+	patch->compactTransfers = pCompact;
+	patch->compactTransferScale = flMax / 65535.0f;
+	patch->numtransfers = nCompact;
+	patch->transfers = NULL;
+
+	return nBytes;
+}
+
 /*
 =============
 WriteWorld
@@ -1531,13 +1612,89 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+// emitlight * reflectivity for every patch, rebuilt each bounce so GatherLight
+// can sum transfers with one multiply-add per transfer.
+static fltx4	*s_pEmitReflect;
+
+static void BuildEmitReflect( void )
+{
+	unsigned int uiPatchCount = g_Patches.Size();
+	for ( unsigned int i = 0; i < uiPatchCount; i++ )
+	{
+		const Vector &reflectivity = g_Patches[i].reflectivity;
+		SubFloat( s_pEmitReflect[i], 0 ) = emitlight[i].x * reflectivity.x;
+		SubFloat( s_pEmitReflect[i], 1 ) = emitlight[i].y * reflectivity.y;
+		SubFloat( s_pEmitReflect[i], 2 ) = emitlight[i].z * reflectivity.z;
+		SubFloat( s_pEmitReflect[i], 3 ) = 0.0f;
+	}
+}
+
+static fltx4 GatherTransfers( const transfer_t *trans, int num )
+{
+	fltx4 sum = Four_Zeros;
+	for ( int k = 0; k < num; k++, trans++ )
+	{
+		sum = MaddSIMD( ReplicateX4( trans->transfer ), s_pEmitReflect[trans->patch], sum );
+	}
+	return sum;
+}
+
+static fltx4 GatherCompactTransfers( const CPatch *patch )
+{
+	const unsigned short *pDelta = patch->compactTransfers;
+	const unsigned short *pQuant = pDelta + patch->numtransfers;
+
+	fltx4 sum = Four_Zeros;
+	int ndxPatch = 0;
+	for ( int k = 0; k < patch->numtransfers; k++ )
+	{
+		ndxPatch += pDelta[k];
+		sum = MaddSIMD( ReplicateX4( (float)pQuant[k] ), s_pEmitReflect[ndxPatch], sum );
+	}
+	return MulSIMD( sum, ReplicateX4( patch->compactTransferScale ) );
+}
+
+// Walks a patch's transfers in whichever form MakeScales stored them.
+class CTransferReader
+{
+public:
+	CTransferReader( const CPatch *patch ) :
+		m_pTransfer( patch->transfers ), m_pDelta( patch->compactTransfers ), m_ndxPatch( 0 )
+	{
+		m_pQuant = m_pDelta ? m_pDelta + patch->numtransfers : NULL;
+		m_flScale = patch->compactTransferScale;
+	}
+
+	void Next( int &ndxPatch, float &flTransfer )
+	{
+		if ( m_pDelta )
+		{
+			m_ndxPatch += *m_pDelta++;
+			ndxPatch = m_ndxPatch;
+			flTransfer = *m_pQuant++ * m_flScale;
+		}
+		else
+		{
+			ndxPatch = m_pTransfer->patch;
+			flTransfer = m_pTransfer->transfer;
+			m_pTransfer++;
+		}
+	}
+
+private:
+	const transfer_t		*m_pTransfer;
+	const unsigned short	*m_pDelta;
+	const unsigned short	*m_pQuant;
+	float					m_flScale;
+	int						m_ndxPatch;
+};
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
-	transfer_t	*trans;
 	int			num;
 	CPatch		*patch;
-	Vector		sum, v;
+	Vector		v;
 
 	while (1)
 	{
@@ -1547,7 +1704,6 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
-		trans = patch->transfers;
 		num = patch->numtransfers;
 		if ( patch->needsBumpmap )
 		{
@@ -1588,9 +1744,18 @@ void GatherLight (int threadnum, void *pUserData)
 			}
 
 			float dot;
-			for (k=0 ; k<num ; k++, trans++)
+			CTransferReader reader( patch );
+			for (k=0 ; k<num ; k++)
 			{
-				CPatch *patch2 = &g_Patches[trans->patch];
+				int ndxPatch2;
+				float flTransfer;
+				reader.Next( ndxPatch2, flTransfer );
+
+				// skips the zero transfers that bridge large compact deltas, they may point at this patch
+				if ( flTransfer == 0.0f )
+					continue;
+
+				CPatch *patch2 = &g_Patches[ndxPatch2];
 
 				// get vector to other patch
 				VectorSubtract (patch2->origin, patch->origin, delta);
@@ -1598,11 +1763,11 @@ void GatherLight (int threadnum, void *pUserData)
 				// find light emitted from other patch
 				for(i=0; i<3; i++)
 				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
+					v[i] = SubFloat( s_pEmitReflect[ndxPatch2], i );
 				}
 				// remove normal already factored into transfer steradian
 				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
+				VectorScale( v, flTransfer * scale, v );
 				
 				Vector bumpTransfer;
 				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
@@ -1624,17 +1789,8 @@ void GatherLight (int threadnum, void *pUserData)
 		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
-			{
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
-				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
-			}
-			VectorCopy( sum, addlight[j].light[0] );
+			fltx4 sum = patch->compactTransfers ? GatherCompactTransfers( patch ) : GatherTransfers( patch->transfers, num );
+			addlight[j].light[0].Init( SubFloat( sum, 0 ), SubFloat( sum, 1 ), SubFloat( sum, 2 ) );
 		}
 	}
 }
@@ -1699,19 +1855,24 @@ void BounceLight (void)
 	}
 #endif
 
+	s_pEmitReflect = (fltx4 *)MemAlloc_AllocAligned( uiPatchCount * sizeof( fltx4 ), 16 );
+
 	i = 0;
 	while ( bouncing )
 	{
+		double flBounceStart = Plat_FloatTime();
+
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
+		BuildEmitReflect();
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
 		// light is always received to leaf patches
 		CollectLight( added );
 
-		qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i+1, added[0], added[1], added[2] );
+		qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f) in %.2f seconds\n", i+1, added[0], added[1], added[2], Plat_FloatTime() - flBounceStart );
 
 		if ( i+1 == numbounce || (added[0] < 1.0 && added[1] < 1.0 && added[2] < 1.0) )
 			bouncing = false;
@@ -1723,6 +1884,9 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	MemAlloc_FreeAligned( s_pEmitReflect );
+	s_pEmitReflect = NULL;
 }
 
 
@@ -1931,8 +2095,17 @@ void MakeAllScales (void)
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	if ( g_bCompactTransfers )
+	{
+		Msg ("transfer lists: %5.1f megs compacted (%5.1f megs as transfer_t)\n"
+			, (float)g_nCompactTransferBytes / (1024*1024)
+			, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	}
+	else
+	{
+		qprintf ("transfer lists: %5.1f megs\n"
+			, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	}
 }
 
 
@@ -2027,6 +2200,7 @@ bool RadWorld_Go()
 	else 
 	{
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
+		PrintDirectLightTimes();
 	}
 
 	// Was the process interrupted?
@@ -2463,6 +2637,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			debug_extra = true;
 		}
+		else if ( !Q_stricmp(argv[i], "-compacttransfers") )
+		{
+			g_bCompactTransfers = true;
+		}
 		else if ( !Q_stricmp(argv[i], "-fastambient") )
 		{
 			g_bFastAmbient = true;
@@ -2817,6 +2995,8 @@ void PrintUsage( int argc, char **argv )
 		"                    Produces soft shadows.\n"
 		"                    Recommended values are between 0 and 5. Default is 0.\n"
 		"  -FullMinidumps  : Write large minidumps on crash.\n"
+		"  -compacttransfers : Store radiosity transfers quantized to 16 bits (half the\n"
+		"                    memory, very slightly lossy).\n"
 		"  -chop           : Smallest number of luxel widths for a bounce patch, used on edges\n"
 		"  -maxchop		   : Coarsest allowed number of luxel widths for a patch, used in face interiors\n"
 		"\n"
@@ -238,6 +238,8 @@ struct CPatch
 
 	int			numtransfers;
 	transfer_t	*transfers;
+	unsigned short	*compactTransfers;		// -compacttransfers: numtransfers patch index deltas, then numtransfers quantized transfers
+	float		compactTransferScale;		// transfer = quantized transfer * compactTransferScale
 
 	short		indices[3];				// displacement use these for subdivision
 };
@@ -275,6 +277,7 @@ extern bool			bRed2Black;
 extern bool         g_bNoSkyRecurse;
 extern bool			bDumpNormals;
 extern bool			g_bFastAmbient;
+extern bool			g_bCompactTransfers;
 extern float		maxchop;
 extern FileHandle_t	pFileSamples[4][4];
 extern qboolean		g_bLowPriority;
@@ -396,6 +399,7 @@ void GetPhongNormal( int facenum, Vector const& spot, Vector& phongnormal );
 int LightForString( char *pLight, Vector& intensity );
 void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers );
 void MakeScales( int ndxPatch, transfer_t *all_transfers );
+int CompactPatchTransfers( CPatch *patch, transfer_t *pTransfers, int nTransfers );
 
 // Run startup code like initialize mathlib.
 void VRAD_Init();
@@ -7,6 +7,7 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include <emmintrin.h>
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -29,19 +30,82 @@ int g_TraceClusterStop = -1;
   void CalcMightSee (leaf_t *leaf, 
 */
 
+static byte s_BitsInByte[256];
+
+class CBitsInByteInit
+{
+public:
+	CBitsInByteInit()
+	{
+		for ( int i = 1; i < 256; i++ )
+		{
+			s_BitsInByte[i] = (byte)( ( i & 1 ) + s_BitsInByte[i >> 1] );
+		}
+	}
+} g_BitsInByteInit;
+
 int CountBits (byte *bits, int numbits)
 {
 	int		i;
 	int		c;
 
+	// whole bytes through the table, then the leftover bits
 	c = 0;
-	for (i=0 ; i<numbits ; i++)
+	for (i=0 ; i<(numbits>>3) ; i++)
+		c += s_BitsInByte[bits[i]];
+
+	for (i<<=3 ; i<numbits ; i++)
 		if ( CheckBit( bits, i ) )
 			c++;
 
 	return c;
 }
 
+
+// Set by vvis at startup when the CPU has SSE2 (and -nosimd wasn't given).
+bool	g_bVisSIMD = false;
+
+/*
+==============
+MergeMightSee
+
+might = prevmight & test, returns nonzero if might has any bits not already in vis.
+portalbytes is rounded to 16 bytes so the SIMD path never needs a tail loop.
+==============
+*/
+static long MergeMightSee_Scalar( const long *prevmight, const long *test, const long *vis, long *might )
+{
+	long more = 0;
+	for (int j=0 ; j<portallongs ; j++)
+	{
+		might[j] = prevmight[j] & test[j];
+		more |= (might[j] & ~vis[j]);
+	}
+	return more;
+}
+
+static long MergeMightSee_SSE2( const long *prevmight, const long *test, const long *vis, long *might )
+{
+	__m128i more = _mm_setzero_si128();
+	int nBlocks = portalbytes >> 4;
+	for (int j=0 ; j<nBlocks ; j++)
+	{
+		__m128i m = _mm_and_si128( _mm_loadu_si128( (const __m128i *)prevmight + j ), _mm_loadu_si128( (const __m128i *)test + j ) );
+		_mm_storeu_si128( (__m128i *)might + j, m );
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i *)vis + j ), m ) );
+	}
+
+	// any nonzero byte means there's something new
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( more, _mm_setzero_si128() ) ) != 0xFFFF;
+}
+
+static inline long MergeMightSee( const long *prevmight, const long *test, const long *vis, long *might )
+{
+	if ( g_bVisSIMD )
+		return MergeMightSee_SSE2( prevmight, test, vis, might );
+	return MergeMightSee_Scalar( prevmight, test, vis, might );
+}
+
 int		c_fullskip;
 int		c_portalskip, c_leafskip;
 int		c_vistest, c_mighttest;
@@ -481,7 +545,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
+	int			i;
 	long		*test, *might, *vis, more;
 	int			pnum;
 
@@ -531,12 +595,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			test = (long *)p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		more = MergeMightSee( (long *)prevstack->mightsee, test, vis, might );
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
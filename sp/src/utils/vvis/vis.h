@@ -106,6 +106,8 @@ extern	byte		*uncompressed;
 extern	int		leafbytes, leaflongs;
 extern	int		portalbytes, portallongs;
 
+extern	bool	g_bVisSIMD;
+
 
 void LeafFlow (int leafnum);
 
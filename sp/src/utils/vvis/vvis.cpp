@@ -22,6 +22,7 @@
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "tier1/checksum_crc.h"
 
 
 int			g_numportals;
@@ -56,6 +57,11 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+bool		g_bVisBench = false;
+bool		g_bNoVisSIMD = false;
+
+char		g_szVisCacheFile[1024];		// set by -incremental
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -281,6 +287,186 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 }
 
 
+/*
+===============================================================================
+
+Incremental vis
+
+The .viscache file next to the .prt holds a hash of every portal's geometry
+along with its portalflood and portalvis from the last compile. A portal keeps
+its old portalvis if its own hash, its new portalflood and the hashes of every
+portal it might see are unchanged, since RecursiveLeafFlow only ever looks at
+portals in the mightsee set. Everything else gets flowed again.
+
+===============================================================================
+*/
+
+#define VISCACHE_ID			(('H'<<24)+('C'<<16)+('S'<<8)+'V')
+#define VISCACHE_VERSION	2
+
+struct viscacheheader_t
+{
+	int		id;
+	int		version;
+	int		portalclusters;
+	int		numportals;
+	int		portalbytes;
+};
+
+static CRC32_t PortalHash( portal_t *p )
+{
+	// the source leaf decides which leafs[].portals list the portal is flowed through from,
+	// it's the leaf of the other half of the pair
+	int srcLeaf = portals[(p - portals) ^ 1].leaf;
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, &srcLeaf, sizeof( srcLeaf ) );
+	CRC32_ProcessBuffer( &crc, &p->leaf, sizeof( p->leaf ) );
+	CRC32_ProcessBuffer( &crc, &p->plane, sizeof( p->plane ) );
+	CRC32_ProcessBuffer( &crc, &p->winding->numpoints, sizeof( p->winding->numpoints ) );
+	CRC32_ProcessBuffer( &crc, p->winding->points, p->winding->numpoints * sizeof( Vector ) );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+/*
+==================
+LoadVisCache
+
+Restores portalvis for the portals that can't have changed and moves the rest
+to the front of sorted_portals (keeping their sort order). Returns how many
+portals still need PortalFlow.
+==================
+*/
+int LoadVisCache( const char *pFilename )
+{
+	int nTotal = g_numportals*2;
+
+	FILE *f = fopen( pFilename, "rb" );
+	if ( !f )
+	{
+		Msg( "No vis cache %s, doing full vis\n", pFilename );
+		return nTotal;
+	}
+
+	viscacheheader_t header;
+	if ( fread( &header, sizeof( header ), 1, f ) != 1 || header.id != VISCACHE_ID || header.version != VISCACHE_VERSION )
+	{
+		Warning( "Vis cache %s is invalid, doing full vis\n", pFilename );
+		fclose( f );
+		return nTotal;
+	}
+
+	// Portal indices are only comparable between compiles if the portal layout stayed the same.
+	if ( header.portalclusters != portalclusters || header.numportals != g_numportals || header.portalbytes != portalbytes )
+	{
+		Msg( "Vis cache %s is for a different cluster/portal count, doing full vis\n", pFilename );
+		fclose( f );
+		return nTotal;
+	}
+
+	CUtlVector<CRC32_t> oldHashes;
+	CUtlVector<byte> oldBits;
+	oldHashes.SetCount( nTotal );
+	oldBits.SetCount( nTotal * portalbytes * 2 );
+	if ( fread( oldHashes.Base(), sizeof( CRC32_t ), nTotal, f ) != (size_t)nTotal ||
+		 fread( oldBits.Base(), portalbytes * 2, nTotal, f ) != (size_t)nTotal )
+	{
+		Warning( "Vis cache %s is truncated, doing full vis\n", pFilename );
+		fclose( f );
+		return nTotal;
+	}
+	fclose( f );
+
+	// Portals whose geometry or neighbor leaf changed
+	byte *pChanged = (byte*)calloc( portalbytes, 1 );
+	int nChanged = 0;
+	for ( int i = 0; i < nTotal; i++ )
+	{
+		if ( PortalHash( &portals[i] ) != oldHashes[i] )
+		{
+			SetBit( pChanged, i );
+			nChanged++;
+		}
+	}
+
+	int nDirty = 0;
+	for ( int i = 0; i < nTotal; i++ )
+	{
+		portal_t *p = sorted_portals[i];
+		int pnum = p - portals;
+		const byte *pOldFlood = &oldBits[pnum * portalbytes * 2];
+		const byte *pOldVis = pOldFlood + portalbytes;
+
+		bool bDirty = CheckBit( pChanged, pnum ) || memcmp( pOldFlood, p->portalflood, portalbytes ) != 0;
+		for ( int j = 0; !bDirty && j < portallongs; j++ )
+		{
+			bDirty = ( ((long *)p->portalflood)[j] & ((long *)pChanged)[j] ) != 0;
+		}
+
+		if ( bDirty )
+		{
+			sorted_portals[nDirty++] = p;
+		}
+		else
+		{
+			memcpy( p->portalvis, pOldVis, portalbytes );
+			p->status = stat_done;
+		}
+	}
+
+	// Put the reused portals back after the dirty ones. They're all stat_done so their order
+	// no longer matters.
+	int nReused = nDirty;
+	for ( int i = 0; i < nTotal; i++ )
+	{
+		if ( portals[i].status == stat_done )
+		{
+			sorted_portals[nReused++] = &portals[i];
+		}
+	}
+	Assert( nReused == nTotal );
+
+	free( pChanged );
+
+	Msg( "Vis cache: %d portals changed, reflowing %d of %d portals\n", nChanged, nDirty, nTotal );
+	return nDirty;
+}
+
+void SaveVisCache( const char *pFilename )
+{
+	FILE *f = fopen( pFilename, "wb" );
+	if ( !f )
+	{
+		Warning( "Couldn't write vis cache %s\n", pFilename );
+		return;
+	}
+
+	viscacheheader_t header;
+	header.id = VISCACHE_ID;
+	header.version = VISCACHE_VERSION;
+	header.portalclusters = portalclusters;
+	header.numportals = g_numportals;
+	header.portalbytes = portalbytes;
+	fwrite( &header, sizeof( header ), 1, f );
+
+	for ( int i = 0; i < g_numportals*2; i++ )
+	{
+		CRC32_t crc = PortalHash( &portals[i] );
+		fwrite( &crc, sizeof( crc ), 1, f );
+	}
+
+	for ( int i = 0; i < g_numportals*2; i++ )
+	{
+		fwrite( portals[i].portalflood, portalbytes, 1, f );
+		fwrite( portals[i].portalvis, portalbytes, 1, f );
+	}
+
+	fclose( f );
+}
+
+
 /*
 ==================
 CalcPortalVis
@@ -308,7 +494,31 @@ void CalcPortalVis (void)
 	}
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		double flStart = Plat_FloatTime();
+
+		int nFlow = g_numportals*2;
+		if ( g_szVisCacheFile[0] )
+		{
+			nFlow = LoadVisCache( g_szVisCacheFile );
+		}
+
+		if ( nFlow )
+		{
+			RunThreadsOnIndividual (nFlow, true, PortalFlow);
+		}
+
+		if ( g_szVisCacheFile[0] )
+		{
+			SaveVisCache( g_szVisCacheFile );
+		}
+
+		if ( g_bVisBench )
+		{
+			double flElapsed = Plat_FloatTime() - flStart;
+			Msg( "PortalFlow: %d portals in %.3f seconds (%.1f portals/sec, %d threads, %s mightsee)\n",
+				nFlow, flElapsed, flElapsed > 0.0 ? nFlow / flElapsed : 0.0,
+				numthreads, g_bVisSIMD ? "SSE2" : "scalar" );
+		}
 	}
 }
 
@@ -472,7 +682,8 @@ void LoadPortals (char *name)
 	leafbytes = ((portalclusters+63)&~63)>>3;
 	leaflongs = leafbytes/sizeof(long);
 	
-	portalbytes = ((g_numportals*2+63)&~63)>>3;
+	// rounded to 128 bits so the SSE2 mightsee loop in flow.cpp has no tail
+	portalbytes = ((g_numportals*2+127)&~127)>>3;
 	portallongs = portalbytes/sizeof(long);
 
 // each file portal is split into two memory portals
@@ -947,6 +1158,20 @@ int ParseCommandLine( int argc, char **argv )
 			Msg ("nosort = true\n");
 			nosort = true;
 		}
+		else if (!Q_stricmp (argv[i],"-incremental"))
+		{
+			Msg ("incremental = true\n");
+			g_szVisCacheFile[0] = 1;	// real path is filled in once we know the map name
+		}
+		else if (!Q_stricmp (argv[i],"-bench"))
+		{
+			g_bVisBench = true;
+		}
+		else if (!Q_stricmp (argv[i],"-nosimd"))
+		{
+			Msg ("nosimd = true\n");
+			g_bNoVisSIMD = true;
+		}
 		else if (!Q_stricmp (argv[i],"-tmpin"))
 			strcpy (inbase, "/tmp");
 		else if( !Q_stricmp( argv[i], "-low" ) )
@@ -1030,6 +1255,10 @@ void PrintUsage( int argc, char **argv )
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
+		"  -incremental    : Reuse vis from the last compile for portals that can't\n"
+		"                    see anything that changed (keeps <mapname>.viscache).\n"
+		"  -bench          : Report PortalFlow time and portals/sec.\n"
+		"  -nosimd         : Don't use SSE2 for the mightsee bit vectors.\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
 		"  -trace <start cluster> <end cluster> : Writes a linefile that traces the vis from one cluster to another for debugging map vis.\n"
@@ -1117,6 +1346,8 @@ int RunVVis( int argc, char **argv )
 	
 	ThreadSetDefault ();
 
+	g_bVisSIMD = !g_bNoVisSIMD && GetCPUInformation()->m_bSSE2;
+
 	char	targetPath[1024];
 	GetPlatformMapPath( source, targetPath, 0, 1024 );
 	Msg ("reading %s\n", targetPath);
@@ -1151,6 +1382,20 @@ int RunVVis( int argc, char **argv )
 		Q_StripExtension( portalfile, portalfile, sizeof( portalfile ) );
 	}
 	strcat (portalfile, ".prt");
+
+	if ( g_szVisCacheFile[0] )
+	{
+		if ( g_bUseMPI )
+		{
+			Warning( "-incremental isn't supported with VMPI, doing full vis\n" );
+			g_szVisCacheFile[0] = 0;
+		}
+		else
+		{
+			Q_strncpy( g_szVisCacheFile, portalfile, sizeof( g_szVisCacheFile ) );
+			Q_SetExtension( g_szVisCacheFile, ".viscache", sizeof( g_szVisCacheFile ) );
+		}
+	}
 	
 	Msg ("reading %s\n", portalfile);
 	LoadPortals (portalfile);